@@ -1,42 +1,81 @@
 #ifndef CHUNK_HPP
 #define CHUNK_HPP
 
+#include <cstdint>
 #include "common.hpp"
 
+/**
+ * Header of one chunk. Used and free chunks tile the whole heap, so the next
+ * chunk starts right after the payload and the previous one is found through
+ * prev_size, no pointers are stored. Sizes are counted in granules of
+ * alignment bytes, the lowest bit of size_and_flags marks a used chunk.
+ */
 struct chunk_t {
-    chunk_t *next;
-    size_t payload_size;
-    bool used;
+    uint32_t size_and_flags;
+    /// Payload size of the previous chunk in granules, 0 for the first chunk.
+    uint32_t prev_size;
 };
 
-constexpr size_t chunk_header_size_with_padding = align_size_up(sizeof(chunk_t));
-constexpr size_t chunk_header_size = chunk_header_size_with_padding;
+static_assert(sizeof(chunk_t) == alignment, "Chunk header has to keep payloads aligned");
+
+constexpr size_t chunk_header_size = sizeof(chunk_t);
 constexpr size_t min_payload_size = 8;
 constexpr size_t min_chunk_size = chunk_header_size + min_payload_size;
+/// Biggest payload whose granule count fits next to the flag.
+constexpr size_t max_payload_size = size_t{UINT32_MAX >> 1} * alignment;
+constexpr uint32_t chunk_used_bit = 1;
+
+inline size_t get_payload_size(const chunk_t *chunk)
+{
+    return size_t{chunk->size_and_flags >> 1} * alignment;
+}
+
+inline void set_payload_size(chunk_t *chunk, size_t payload_size)
+{
+    assert(payload_size % alignment == 0 && payload_size <= max_payload_size);
+    chunk->size_and_flags = static_cast<uint32_t>(payload_size / alignment) << 1 | (chunk->size_and_flags & chunk_used_bit);
+}
 
+inline bool is_used(const chunk_t *chunk)
+{
+    return chunk->size_and_flags & chunk_used_bit;
+}
+
+inline void set_used(chunk_t *chunk, bool used)
+{
+    chunk->size_and_flags = (chunk->size_and_flags & ~chunk_used_bit) | (used ? chunk_used_bit : 0);
+}
+
+inline size_t get_prev_payload_size(const chunk_t *chunk)
+{
+    return size_t{chunk->prev_size} * alignment;
+}
+
+inline void set_prev_payload_size(chunk_t *chunk, size_t payload_size)
+{
+    chunk->prev_size = static_cast<uint32_t>(payload_size / alignment);
+}
 
 /**
- * Saves one chunk into memory.
+ * Saves one free chunk into memory.
  * @param start_addr
  * @param payload_size Size of payload
  * @return
  */
 inline chunk_t * initialize_chunk(address_t start_addr, size_t payload_size)
 {
-    assert(payload_size >= min_payload_size);
-
-    chunk_t header{nullptr, payload_size, false};
-
-    auto mem_addr = reinterpret_cast<chunk_t *>(start_addr);
-    *mem_addr = header;
-    return mem_addr;
+    auto chunk = reinterpret_cast<chunk_t *>(start_addr);
+    chunk->size_and_flags = 0;
+    chunk->prev_size = 0;
+    set_payload_size(chunk, payload_size);
+    return chunk;
 }
 
 inline void * get_chunk_data(const chunk_t *chunk)
 {
     assert(chunk != nullptr);
     auto ptr = reinterpret_cast<address_t>(chunk);
-    ptr += chunk_header_size_with_padding;
+    ptr += chunk_header_size;
     return reinterpret_cast<void *>(ptr);
 }
 
@@ -50,8 +89,20 @@ inline chunk_t * get_chunk_from_payload_addr(address_t payload_addr)
 inline size_t get_chunk_size(const chunk_t *chunk)
 {
     assert(chunk != nullptr);
-    return chunk_header_size_with_padding + chunk->payload_size;
+    return chunk_header_size + get_payload_size(chunk);
+}
+
+/// Chunk physically following given one, callers check it against the heap end.
+inline chunk_t * get_next_chunk(const chunk_t *chunk)
+{
+    return reinterpret_cast<chunk_t *>(reinterpret_cast<address_t>(chunk) + get_chunk_size(chunk));
 }
 
+/// Chunk physically preceding given one, callers check the chunk is not the first one.
+inline chunk_t * get_prev_chunk(const chunk_t *chunk)
+{
+    return reinterpret_cast<chunk_t *>(reinterpret_cast<address_t>(chunk) - get_prev_payload_size(chunk) -
+                                       chunk_header_size);
+}
 
 #endif //CHUNK_HPP
@@ -6,15 +6,35 @@
 #include <cmath>
 #include <cstdint>
 
+/// Alignment of every payload, bigger alignments are requested per allocation.
 constexpr size_t alignment = 8;
+/// Biggest alignment that can be requested per allocation.
+constexpr size_t max_alignment = 4096;
 using address_t = uintptr_t;
 
-constexpr size_t align_size_up(size_t size) noexcept
+constexpr bool is_power_of_two(size_t value) noexcept
 {
-    while (size % alignment != 0) {
-        size++;
-    }
-    return size;
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+/// Rounds size up to given power of two.
+constexpr size_t align_size_up(size_t size, size_t align = alignment) noexcept
+{
+    return (size + align - 1) & ~(align - 1);
+}
+
+/// Rounds address up to given power of two.
+inline address_t align_addr_up(address_t addr, size_t align)
+{
+    assert(is_power_of_two(align));
+    return (addr + align - 1) & ~static_cast<address_t>(align - 1);
+}
+
+/// Rounds address down to given power of two.
+inline address_t align_addr_down(address_t addr, size_t align)
+{
+    assert(is_power_of_two(align));
+    return addr & ~static_cast<address_t>(align - 1);
 }
 
 inline bool is_aligned(address_t ptr)
@@ -0,0 +1,161 @@
+#ifndef DIRECT_MAPPING_HPP
+#define DIRECT_MAPPING_HPP
+
+#include <new>
+#include <sys/mman.h>
+#include "common.hpp"
+#include "os_memory.hpp"
+
+/**
+ * Huge blocks served by mappings of their own instead of the heap, so they
+ * neither search for a gap nor leave one behind when freed. Every mapping
+ * starts with a small header that links it into the list, the payload
+ * follows within the first page. Mapping is done by map, remap and unmap
+ * outside of the list, so a thread-safe heap has to lock only around add,
+ * remove and resized.
+ */
+class direct_mapping_list {
+public:
+    direct_mapping_list() = default;
+
+    ~direct_mapping_list()
+    {
+        release_all();
+    }
+
+    direct_mapping_list(const direct_mapping_list &) = delete;
+    direct_mapping_list & operator=(const direct_mapping_list &) = delete;
+
+    /**
+     * Maps memory for one payload, it has to be added to a list afterwards.
+     * @param payload_alignment Power of two up to the page size.
+     * @return nullptr when the mapping failed.
+     */
+    static void * map(size_t payload_size, size_t payload_alignment)
+    {
+        size_t payload_offset = align_size_up(sizeof(mapping_t), payload_alignment);
+        size_t map_size = align_size_up(payload_offset + payload_size, get_page_size());
+        void *ptr = map_memory(map_size);
+        if (!ptr) {
+            return nullptr;
+        }
+        new (ptr) mapping_t{nullptr, nullptr, map_size};
+        return reinterpret_cast<void *>(reinterpret_cast<address_t>(ptr) + payload_offset);
+    }
+
+    /// Unmaps payload of map that is not in any list.
+    static void unmap(void *ptr) noexcept
+    {
+        mapping_t *mapping = get_mapping(ptr);
+        unmap_memory(mapping, mapping->map_size);
+    }
+
+    /// Payload size rounded up to whole pages.
+    static size_t get_usable_size(const void *ptr)
+    {
+        const mapping_t *mapping = get_mapping(ptr);
+        return reinterpret_cast<address_t>(mapping) + mapping->map_size - reinterpret_cast<address_t>(ptr);
+    }
+
+    /// Takes over payload of map in constant time.
+    void add(void *ptr)
+    {
+        mapping_t *mapping = get_mapping(ptr);
+        mapping->next = head;
+        if (head) {
+            head->prev = mapping;
+        }
+        head = mapping;
+        count++;
+        mapped_size += mapping->map_size;
+    }
+
+    /// Gives up payload in constant time, the caller unmaps it then.
+    void remove(void *ptr) noexcept
+    {
+        mapping_t *mapping = get_mapping(ptr);
+        if (mapping->prev) {
+            mapping->prev->next = mapping->next;
+        }
+        else {
+            head = mapping->next;
+        }
+        if (mapping->next) {
+            mapping->next->prev = mapping->prev;
+        }
+        count--;
+        mapped_size -= mapping->map_size;
+    }
+
+    /**
+     * Grows or shrinks the mapping of given payload without moving it. Pages
+     * past the new end are unmapped, growing succeeds only if the address
+     * space right after the mapping is free. Like map, it runs outside of the
+     * list, which learns about the new size from resized.
+     */
+    static bool remap(void *ptr, size_t payload_size)
+    {
+        mapping_t *mapping = get_mapping(ptr);
+        auto mapping_addr = reinterpret_cast<address_t>(mapping);
+        size_t new_map_size = align_size_up(reinterpret_cast<address_t>(ptr) + payload_size - mapping_addr,
+                                            get_page_size());
+        if (new_map_size < mapping->map_size) {
+            unmap_memory(reinterpret_cast<void *>(mapping_addr + new_map_size), mapping->map_size - new_map_size);
+        }
+        else if (new_map_size > mapping->map_size &&
+                 mremap(mapping, mapping->map_size, new_map_size, 0) == MAP_FAILED) {
+            return false;
+        }
+        mapping->map_size = new_map_size;
+        return true;
+    }
+
+    /// Accounts remap of payload in the list, old_usable_size is get_usable_size from before it.
+    void resized(const void *ptr, size_t old_usable_size) noexcept
+    {
+        mapped_size = mapped_size - old_usable_size + get_usable_size(ptr);
+    }
+
+    /// Unmaps every mapping, their payloads are lost.
+    void release_all() noexcept
+    {
+        while (head) {
+            mapping_t *mapping = head;
+            head = mapping->next;
+            unmap_memory(mapping, mapping->map_size);
+        }
+        count = 0;
+        mapped_size = 0;
+    }
+
+    size_t get_count() const
+    {
+        return count;
+    }
+
+    size_t get_mapped_size() const
+    {
+        return mapped_size;
+    }
+
+private:
+    /// Placed at the start of the mapping.
+    struct mapping_t {
+        mapping_t *prev;
+        mapping_t *next;
+        size_t map_size;
+    };
+
+    mapping_t *head = nullptr;
+    size_t count = 0;
+    size_t mapped_size = 0;
+
+    /// The payload starts at most a page after the mapping, the header is in front of it.
+    static mapping_t * get_mapping(const void *ptr)
+    {
+        return reinterpret_cast<mapping_t *>(
+            align_addr_down(reinterpret_cast<address_t>(ptr) - sizeof(mapping_t), get_page_size()));
+    }
+};
+
+#endif //DIRECT_MAPPING_HPP
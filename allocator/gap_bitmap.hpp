@@ -0,0 +1,158 @@
+#ifndef GAP_BITMAP_HPP
+#define GAP_BITMAP_HPP
+
+#include <algorithm>
+#include <cstring>
+#include "common.hpp"
+#include "os_memory.hpp"
+
+/**
+ * One bit per granule of a chunk list heap, set while the granule belongs to
+ * a free chunk, header included. Runs of set bits are the free gaps, so the
+ * heap finds a gap by scanning 64 granules per word instead of visiting every
+ * chunk header. The bits live in memory mapped apart from the heap.
+ */
+class gap_bitmap {
+public:
+    /// Result of find_run when no run is long enough.
+    static constexpr size_t npos = SIZE_MAX;
+
+    gap_bitmap() = default;
+
+    ~gap_bitmap()
+    {
+        release();
+    }
+
+    gap_bitmap(const gap_bitmap &) = delete;
+    gap_bitmap & operator=(const gap_bitmap &) = delete;
+
+    bool is_allocated() const
+    {
+        return words != nullptr;
+    }
+
+    /**
+     * Prepares cleared bitmap of given size, the memory is kept for later
+     * calls as long as it is big enough.
+     * @throws allocator_exception if the memory cannot be mapped.
+     */
+    void assign(size_t new_bit_count)
+    {
+        size_t needed = align_size_up(get_word_count(new_bit_count) * sizeof(uint64_t), get_page_size());
+        if (needed > map_size) {
+            release();
+            words = static_cast<uint64_t *>(map_memory(needed));
+            if (!words) {
+                throw allocator_exception{"Cannot map memory."};
+            }
+            map_size = needed;
+        }
+        else {
+            // Bits past the old count were never set.
+            std::memset(words, 0, get_word_count(bit_count) * sizeof(uint64_t));
+        }
+        bit_count = new_bit_count;
+    }
+
+    void release() noexcept
+    {
+        if (words) {
+            unmap_memory(words, map_size);
+        }
+        words = nullptr;
+        map_size = 0;
+        bit_count = 0;
+    }
+
+    size_t get_bit_count() const
+    {
+        return bit_count;
+    }
+
+    bool test(size_t bit) const
+    {
+        assert(bit < bit_count);
+        return words[bit / word_bits] >> (bit % word_bits) & 1;
+    }
+
+    /// Sets or clears bits [begin, end), whole words at a time.
+    void assign_range(size_t begin, size_t end, bool value)
+    {
+        assert(begin <= end && end <= bit_count);
+        while (begin < end) {
+            size_t offset = begin % word_bits;
+            size_t length = std::min(word_bits - offset, end - begin);
+            uint64_t mask = (length == word_bits ? ~uint64_t{0} : (uint64_t{1} << length) - 1) << offset;
+            if (value) {
+                words[begin / word_bits] |= mask;
+            }
+            else {
+                words[begin / word_bits] &= ~mask;
+            }
+            begin += length;
+        }
+    }
+
+    /**
+     * First run of at least length set bits that starts at or after given bit.
+     * @return Index of the first bit of the run, npos if there is none.
+     */
+    size_t find_run(size_t from, size_t length) const
+    {
+        size_t run_begin = find_next(from, true, bit_count);
+        while (run_begin < bit_count) {
+            // The scan stops as soon as the run is long enough, a huge gap is not measured whole.
+            size_t run_end = find_next(run_begin, false, std::min(run_begin + length, bit_count));
+            if (run_end - run_begin >= length) {
+                return run_begin;
+            }
+            run_begin = find_next(run_end, true, bit_count);
+        }
+        return npos;
+    }
+
+    /// Number of set bits, i.e. free granules.
+    size_t count() const
+    {
+        size_t result = 0;
+        for (size_t i = 0; i < get_word_count(bit_count); ++i) {
+            result += static_cast<size_t>(__builtin_popcountll(words[i]));
+        }
+        return result;
+    }
+
+private:
+    static constexpr size_t word_bits = 64;
+
+    uint64_t *words = nullptr;
+    size_t map_size = 0;
+    size_t bit_count = 0;
+
+    static size_t get_word_count(size_t bits)
+    {
+        return (bits + word_bits - 1) / word_bits;
+    }
+
+    /// First bit in [bit, end) that has given value, end if there is none.
+    size_t find_next(size_t bit, bool value, size_t end) const
+    {
+        if (bit >= end) {
+            return end;
+        }
+        // Inverting the words turns the search for a clear bit into one for a set bit.
+        const uint64_t flip = value ? 0 : ~uint64_t{0};
+        size_t index = bit / word_bits;
+        size_t end_index = (end - 1) / word_bits;
+        uint64_t word = (words[index] ^ flip) & (~uint64_t{0} << (bit % word_bits));
+        while (word == 0) {
+            if (++index > end_index) {
+                return end;
+            }
+            word = words[index] ^ flip;
+        }
+        return std::min(index * word_bits + static_cast<size_t>(__builtin_ctzll(word)), end);
+    }
+};
+
+#endif //GAP_BITMAP_HPP
@@ -0,0 +1,81 @@
+#ifndef HEAP_FILE_HPP
+#define HEAP_FILE_HPP
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "mapped_heap.hpp"
+
+/// "IBHEAP01" read as little-endian number.
+constexpr uint64_t heap_file_magic = 0x3130504145484249;
+
+/**
+ * Chunk list heap kept in a memory mapped file, so data structures built in
+ * the heap survive restarts without being serialized. A missing file is
+ * created with given heap size, an existing one is mapped and its heap is
+ * attached the way it was left, see inblock_allocator_heap::attach.
+ *
+ * The file may be mapped at a different address every time, see mapped_heap.
+ *
+ * The heap should not use thread caches, slab pools or direct mappings,
+ * blocks they hold are not in the file. The heap must not be used after
+ * the heap_file is destroyed.
+ */
+class heap_file : public mapped_heap {
+public:
+    /**
+     * @param heap_size Size of the heap of a new file, an existing file keeps its size.
+     */
+    heap_file(inblock_allocator_heap &heap, const std::string &path, size_t heap_size)
+    {
+        const std::string description = "heap file " + path;
+        fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            throw allocator_exception{"Cannot open " + description + ": " + std::strerror(errno)};
+        }
+        created = get_file_size(description) == 0;
+        map_file(description, created ? get_map_size(heap_size) : 0);
+        if (map_size < get_page_size() + min_chunk_size) {
+            throw allocator_exception{"Heap file " + path + " is too small"};
+        }
+
+        if (created) {
+            lay_out_heap();
+            heap(get_heap_memory(), get_heap_size(), allocation_strategy::chunk_list);
+            publish(heap_file_magic);
+        }
+        else {
+            if (!holds_heap(heap_file_magic, sizeof(mapped_heap_header_t))) {
+                throw allocator_exception{"Not a heap file " + path};
+            }
+            heap.attach(get_heap_memory(), get_heap_size());
+        }
+    }
+
+    ~heap_file()
+    {
+        sync();
+    }
+
+    /// Whether the file did not exist and the heap in it is empty.
+    bool is_created() const
+    {
+        return created;
+    }
+
+    /// Writes modified pages to the file, it is done in the destructor too.
+    void sync()
+    {
+        if (mapping) {
+            msync(mapping, map_size, MS_SYNC);
+        }
+    }
+
+private:
+    bool created = false;
+};
+
+#endif //HEAP_FILE_HPP
@@ -0,0 +1,74 @@
+#ifndef HEAP_MUTEX_HPP
+#define HEAP_MUTEX_HPP
+
+#include <cerrno>
+#include <mutex>
+#include <new>
+#include <pthread.h>
+
+/**
+ * Lock of the heap. It is a plain std::mutex unless the heap is shared with
+ * other processes, then a process-shared robust mutex stored next to the
+ * heap memory is used instead, see shared_heap.
+ */
+class heap_mutex {
+public:
+    void lock()
+    {
+        if (!shared) {
+            local.lock();
+            return;
+        }
+        // The owner died holding the lock. Its last operation may be unfinished, but the lock stays usable.
+        if (pthread_mutex_lock(shared) == EOWNERDEAD) {
+            pthread_mutex_consistent(shared);
+        }
+    }
+
+    void unlock()
+    {
+        if (shared) {
+            pthread_mutex_unlock(shared);
+        }
+        else {
+            local.unlock();
+        }
+    }
+
+    /**
+     * Unlocks the local mutex anew in a child process forked while it was held.
+     * The shared mutex is left alone, the parent still uses it.
+     */
+    void reset_after_fork() noexcept
+    {
+        new (&local) std::mutex;
+    }
+
+    pthread_mutex_t * get_shared() const
+    {
+        return shared;
+    }
+
+    /// @param mutex Initialized by initialize_shared_mutex, nullptr goes back to the local mutex.
+    void set_shared(pthread_mutex_t *mutex)
+    {
+        shared = mutex;
+    }
+
+private:
+    std::mutex local;
+    pthread_mutex_t *shared = nullptr;
+};
+
+/// Prepares mutex placed in memory shared by several processes.
+inline void initialize_shared_mutex(pthread_mutex_t *mutex)
+{
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(mutex, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+}
+
+#endif //HEAP_MUTEX_HPP
@@ -0,0 +1,144 @@
+#ifndef HEAP_STATS_HPP
+#define HEAP_STATS_HPP
+
+#include <cstdint>
+#include <ostream>
+#include "common.hpp"
+
+/// Histogram with power of two buckets, bucket i counts values in [2^(i-1), 2^i).
+struct log2_histogram_t {
+    static constexpr size_t bucket_count = 32;
+
+    uint64_t buckets[bucket_count] = {};
+
+    void record(size_t value)
+    {
+        size_t bucket = 0;
+        while (value != 0 && bucket < bucket_count - 1) {
+            value >>= 1;
+            bucket++;
+        }
+        buckets[bucket]++;
+    }
+
+    uint64_t get_total() const
+    {
+        uint64_t total = 0;
+        for (uint64_t count : buckets) {
+            total += count;
+        }
+        return total;
+    }
+};
+
+/**
+ * Counters collected by the heap while statistics are enabled. Blocks kept in
+ * thread caches and whole slabs count as live, this is the view of the engine.
+ */
+struct heap_counters_t {
+    size_t live_bytes = 0;
+    size_t peak_bytes = 0;
+    size_t live_blocks = 0;
+    uint64_t allocations = 0;
+    uint64_t deallocations = 0;
+    uint64_t failed_allocations = 0;
+    uint64_t purges = 0;
+    /// Bytes given back to the system by all purges, pages purged repeatedly count every time.
+    size_t purged_bytes = 0;
+    /// Distance from the heap start to the end of the highest block ever allocated, headers included. Blocks of mapped regions do not count.
+    size_t high_water_mark = 0;
+    /// Requested payload sizes.
+    log2_histogram_t allocation_sizes;
+    /// Chunks walked past by one first-fit search of the chunk list.
+    log2_histogram_t walk_lengths;
+
+    void on_allocate(size_t payload_size)
+    {
+        live_bytes += payload_size;
+        live_blocks++;
+        allocations++;
+        if (live_bytes > peak_bytes) {
+            peak_bytes = live_bytes;
+        }
+    }
+
+    void on_deallocate(size_t payload_size)
+    {
+        live_bytes -= payload_size;
+        live_blocks--;
+        deallocations++;
+    }
+
+    void on_resize(size_t old_payload_size, size_t new_payload_size)
+    {
+        live_bytes = live_bytes - old_payload_size + new_payload_size;
+        if (live_bytes > peak_bytes) {
+            peak_bytes = live_bytes;
+        }
+    }
+};
+
+/// Snapshot returned by inblock_allocator_heap::get_stats.
+struct heap_stats_t {
+    size_t heap_size = 0;
+    /// Blocks the engine considers used, counted by walking the heap.
+    size_t used_blocks = 0;
+    size_t free_bytes = 0;
+    size_t largest_free_gap = 0;
+    /// Regions mapped by growable heap, they are not part of heap_size.
+    size_t region_count = 0;
+    size_t region_bytes = 0;
+    /// Blocks served by mappings of their own, they are counted in used_blocks too.
+    size_t direct_count = 0;
+    size_t direct_bytes = 0;
+    heap_counters_t counters;
+
+    /// Share of free memory that is not usable for the biggest possible request, 0 means no fragmentation.
+    double get_fragmentation() const
+    {
+        if (free_bytes == 0) {
+            return 0.0;
+        }
+        return 1.0 - static_cast<double>(largest_free_gap) / static_cast<double>(free_bytes);
+    }
+};
+
+inline void write_json(std::ostream &out, const log2_histogram_t &histogram)
+{
+    out << "[";
+    for (size_t i = 0; i < log2_histogram_t::bucket_count; ++i) {
+        out << (i == 0 ? "" : ", ") << histogram.buckets[i];
+    }
+    out << "]";
+}
+
+inline void write_json(std::ostream &out, const heap_stats_t &stats)
+{
+    const heap_counters_t &counters = stats.counters;
+    out << "{"
+        << "\"heap_size\": " << stats.heap_size << ", "
+        << "\"used_blocks\": " << stats.used_blocks << ", "
+        << "\"free_bytes\": " << stats.free_bytes << ", "
+        << "\"largest_free_gap\": " << stats.largest_free_gap << ", "
+        << "\"fragmentation\": " << stats.get_fragmentation() << ", "
+        << "\"region_count\": " << stats.region_count << ", "
+        << "\"region_bytes\": " << stats.region_bytes << ", "
+        << "\"direct_count\": " << stats.direct_count << ", "
+        << "\"direct_bytes\": " << stats.direct_bytes << ", "
+        << "\"live_bytes\": " << counters.live_bytes << ", "
+        << "\"peak_bytes\": " << counters.peak_bytes << ", "
+        << "\"live_blocks\": " << counters.live_blocks << ", "
+        << "\"allocations\": " << counters.allocations << ", "
+        << "\"deallocations\": " << counters.deallocations << ", "
+        << "\"failed_allocations\": " << counters.failed_allocations << ", "
+        << "\"purges\": " << counters.purges << ", "
+        << "\"purged_bytes\": " << counters.purged_bytes << ", "
+        << "\"high_water_mark\": " << counters.high_water_mark << ", "
+        << "\"allocation_sizes_log2\": ";
+    write_json(out, counters.allocation_sizes);
+    out << ", \"walk_lengths_log2\": ";
+    write_json(out, counters.walk_lengths);
+    out << "}";
+}
+
+#endif //HEAP_STATS_HPP
@@ -1,7 +1,153 @@
+#include <atomic>
 #include "inblock_allocator.hpp"
 
-chunk_list_t inblock_allocator_heap::chunk_list = nullptr;
-address_t inblock_allocator_heap::start_addr = 0;
-address_t inblock_allocator_heap::end_addr = 0;
-size_t inblock_allocator_heap::size = 0;
-size_t inblock_allocator_heap::allocators_count = 0;
+static std::atomic<uint64_t> last_generation{0};
+
+/// Heaps that are alive, so that exiting threads do not flush caches into destroyed heaps.
+static std::mutex live_heaps_mutex;
+static inblock_allocator_heap *live_heaps = nullptr;
+
+inblock_allocator_heap::inblock_allocator_heap()
+{
+    std::lock_guard<std::mutex> guard{live_heaps_mutex};
+    next_live = live_heaps;
+    live_heaps = this;
+}
+
+inblock_allocator_heap::~inblock_allocator_heap()
+{
+    std::lock_guard<std::mutex> guard{live_heaps_mutex};
+    inblock_allocator_heap **link = &live_heaps;
+    while (*link != this) {
+        link = &(*link)->next_live;
+    }
+    *link = next_live;
+}
+
+uint64_t inblock_allocator_heap::next_generation()
+{
+    return ++last_generation;
+}
+
+bool inblock_allocator_heap::is_live(const inblock_allocator_heap *heap, uint64_t generation)
+{
+    for (const inblock_allocator_heap *live_heap = live_heaps; live_heap; live_heap = live_heap->next_live) {
+        if (live_heap == heap) {
+            return heap->generation == generation;
+        }
+    }
+    return false;
+}
+
+/// Caches of one thread, at most one per heap. Gives the blocks back when the thread exits.
+struct thread_cache_table {
+    static constexpr size_t max_heaps = 8;
+
+    struct entry_t {
+        inblock_allocator_heap *heap;
+        thread_cache cache;
+    };
+
+    entry_t entries[max_heaps] = {};
+    size_t entries_count = 0;
+
+    ~thread_cache_table()
+    {
+        for (size_t i = 0; i < entries_count; ++i) {
+            inblock_allocator_heap::flush_thread_cache(entries[i].heap, entries[i].cache);
+        }
+    }
+};
+
+thread_cache * inblock_allocator_heap::get_thread_cache()
+{
+    static thread_local thread_cache_table table;
+
+    for (size_t i = 0; i < table.entries_count; ++i) {
+        thread_cache_table::entry_t &entry = table.entries[i];
+        if (entry.heap == this) {
+            if (entry.cache.get_generation() != generation) {
+                entry.cache.reset(generation);
+            }
+            return &entry.cache;
+        }
+    }
+
+    if (table.entries_count == thread_cache_table::max_heaps) {
+        return nullptr;
+    }
+    thread_cache_table::entry_t &entry = table.entries[table.entries_count++];
+    entry.heap = this;
+    entry.cache.reset(generation);
+    return &entry.cache;
+}
+
+void inblock_allocator_heap::flush_thread_cache(inblock_allocator_heap *heap, thread_cache &cache) noexcept
+{
+    std::lock_guard<std::mutex> guard{live_heaps_mutex};
+    if (is_live(heap, cache.get_generation())) {
+        heap->flush_thread_cache(cache);
+    }
+}
+
+void inblock_allocator_heap::flush_thread_cache(thread_cache &cache) noexcept
+{
+    if (cache.get_generation() != generation) {
+        return;
+    }
+
+    std::lock_guard<heap_mutex> guard{mutex};
+    for (size_t size_class = 0; size_class < thread_cache::size_class_count; ++size_class) {
+        while (void *ptr = cache.pop(size_class)) {
+            deallocate_block(ptr);
+        }
+    }
+}
+
+void * inblock_allocator_heap::allocate_cached(size_t payload_size)
+{
+    thread_cache *cache = get_thread_cache();
+    if (!cache) {
+        std::lock_guard<heap_mutex> guard{mutex};
+        return allocate_block(payload_size);
+    }
+
+    size_t size_class = thread_cache::get_size_class(payload_size);
+    void *ptr = cache->pop(size_class);
+    if (ptr) {
+        return ptr;
+    }
+
+    // Cache miss, take a whole batch of blocks under one lock.
+    size_t class_payload_size = thread_cache::get_class_payload_size(size_class);
+    std::lock_guard<heap_mutex> guard{mutex};
+    ptr = allocate_block(class_payload_size);
+    for (size_t i = 1; ptr && i < thread_cache::refill_count; ++i) {
+        void *block = allocate_block(class_payload_size);
+        if (!block) {
+            break;
+        }
+        cache->push(size_class, block);
+    }
+    return ptr;
+}
+
+void inblock_allocator_heap::deallocate_cached(void *ptr, size_t payload_size) noexcept
+{
+    thread_cache *cache = get_thread_cache();
+    if (!cache) {
+        std::lock_guard<heap_mutex> guard{mutex};
+        deallocate_block(ptr);
+        return;
+    }
+
+    size_t size_class = thread_cache::get_size_class(payload_size);
+    if (cache->is_full(size_class)) {
+        // Drain half of the bin under one lock.
+        std::lock_guard<heap_mutex> guard{mutex};
+        for (size_t i = 0; i < thread_cache::max_blocks_per_class / 2; ++i) {
+            deallocate_block(cache->pop(size_class));
+        }
+    }
+    cache->push(size_class, ptr);
+}
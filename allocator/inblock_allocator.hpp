@@ -1,340 +1,1633 @@
+#ifndef INBLOCK_ALLOCATOR_HPP
+#define INBLOCK_ALLOCATOR_HPP
+
+#include <algorithm>
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
-#include <tuple>
+#include <mutex>
+#include <type_traits>
 #include "common.hpp"
 #include "chunk.hpp"
+#include "gap_bitmap.hpp"
+#include "tlsf.hpp"
+#include "thread_cache.hpp"
+#include "slab_pool.hpp"
+#include "region_list.hpp"
+#include "direct_mapping.hpp"
+#include "os_memory.hpp"
+#include "heap_mutex.hpp"
+#include "heap_stats.hpp"
+#include "trace.hpp"
 #include "allocator_exception.hpp"
 
-using chunk_list_t = chunk_t *;
+/// Algorithm that manages the memory of the heap.
+enum class allocation_strategy {
+    /// First-fit walk over address ordered chunks with boundary tags.
+    chunk_list,
+    /// Two-level segregated fit with bounded allocation and deallocation time.
+    tlsf,
+    /// Bump pointer, deallocation is a no-op and memory is released by reset or rewind.
+    monotonic
+};
+
+/**
+ * Fit policies pick the free chunk of chunk list heap that a block is placed
+ * into, see inblock_allocator. Other strategies ignore them.
+ */
+
+/// Lowest free chunk that fits, the front of the heap is searched over and over.
+struct first_fit {};
+
+/// First chunk that fits after the one allocated last, wrapping around at the heap end.
+struct next_fit {};
+
+/// Smallest chunk that fits, every free chunk is visited unless one fits exactly.
+struct best_fit {};
+
+/// Position of monotonic heap together with its counters, see inblock_allocator_heap::rewind.
+struct heap_marker_t {
+    address_t position;
+    /// Counters to restore, they are kept only while statistics are enabled.
+    size_t live_bytes;
+    size_t live_blocks;
+};
+
+/// When free memory of the heap is given back to the system, see inblock_allocator_heap::purge.
+struct purge_policy_t {
+    /// Free gaps smaller than this stay resident.
+    size_t min_gap = 64 * 1024;
+    /// Purge runs on its own once this many bytes were freed since the last one, 0 leaves it to explicit purge calls.
+    size_t decay_bytes = 0;
+    /// MADV_FREE instead of MADV_DONTNEED, cheaper but the pages are reclaimed only under memory pressure.
+    bool lazy = false;
+};
 
+/**
+ * In thread-safe mode the heap may be used from several threads. Small blocks
+ * are served from per-thread caches, everything else goes through the central
+ * engine under a lock. Caches of exiting threads are returned to the heap, so
+ * the heap memory has to outlive every thread that used the heap.
+ */
 class inblock_allocator_heap {
 public:
-    static chunk_list_t chunk_list;
+    inblock_allocator_heap();
+    ~inblock_allocator_heap();
 
-    static address_t get_start_addr()
+    inblock_allocator_heap(const inblock_allocator_heap &) = delete;
+    inblock_allocator_heap & operator=(const inblock_allocator_heap &) = delete;
+
+    address_t get_start_addr() const
     {
         return start_addr;
     }
 
-    static address_t get_end_addr()
+    address_t get_end_addr() const
     {
         return end_addr;
     }
 
-    static size_t get_size()
+    size_t get_size() const
     {
         return size;
     }
 
-    static size_t get_allocators_count()
+    allocation_strategy get_strategy() const
     {
-        return allocators_count;
+        return strategy;
     }
 
-    static void increase_allocators_count()
+    const tlsf_pool & get_tlsf_pool() const
     {
-        allocators_count++;
+        return tlsf;
     }
 
-    static void decrease_allocators_count()
+    bool is_thread_safe() const
     {
-        allocators_count--;
+        return thread_safe;
     }
 
-    void operator()(void *ptr, size_t n_bytes)
+    /// Should be set before anything is allocated from the heap.
+    void set_thread_safe(bool value)
     {
-        if (n_bytes < min_chunk_size) {
-            throw allocator_exception{"More memory needed."};
-        }
+        thread_safe = value;
+    }
 
-        auto intptr = reinterpret_cast<address_t>(ptr);
-        start_addr = align_addr(intptr, upward);
-        end_addr = align_addr(start_addr + n_bytes, downward);
-        size = diff(end_addr, start_addr);
+    /// Whether thread-safe heap serves small blocks from per-thread caches.
+    bool uses_thread_caches() const
+    {
+        return thread_safe && thread_caches && strategy != allocation_strategy::monotonic;
     }
 
-private:
-    static address_t start_addr;
-    static address_t end_addr;
-    static size_t size;
-    static size_t allocators_count;
-
-    enum Direction {
-        downward,
-        upward
-    };
+    /**
+     * Should be set before anything is allocated from the heap. Without caches
+     * every block goes through the lock, but no thread holds blocks that the
+     * heap does not know about.
+     */
+    void set_thread_caches(bool value)
+    {
+        thread_caches = value;
+    }
 
-    address_t align_addr(address_t ptr, Direction direction) const
+    /**
+     * Guards the heap by mutex shared with other processes instead of its own,
+     * see shared_heap. Should be set before anything is allocated from the heap.
+     * @param value Initialized by initialize_shared_mutex, nullptr goes back to the own mutex.
+     */
+    void set_shared_mutex(pthread_mutex_t *value)
     {
-        if (is_aligned(ptr)) {
-            return ptr;
-        }
-        else {
-            return find_first_aligned(ptr, direction);
-        }
+        mutex.set_shared(value);
     }
 
-    address_t find_first_aligned(address_t ptr, Direction direction) const
+    /**
+     * Keeps the chunk where next_fit resumes in memory shared with other
+     * processes instead of in the heap, see shared_heap. Every process then
+     * sees the rover moved by the merges of the others.
+     * @param value Offset of the rover from the heap start, it must point to a
+     *              chunk header. nullptr goes back to the own rover.
+     */
+    void set_shared_rover(uint64_t *value)
     {
-        while (!is_aligned(ptr)) {
-            if (direction == downward) {
-                ptr--;
-            }
-            else if (direction == upward) {
-                ptr++;
-            }
-        }
-        return ptr;
+        shared_rover = value;
     }
 
-};
+    /**
+     * Handlers for pthread_atfork of a thread-safe heap. The lock is taken
+     * before fork, so no other thread is inside the heap when the process is
+     * copied, and released in both processes afterwards.
+     */
+    void prepare_fork()
+    {
+        mutex.lock();
+    }
 
-template<typename T, typename HeapHolder>
-class inblock_allocator {
-public:
-    using value_type = T;
-    using heap_type = decltype(HeapHolder::heap);
-    static constexpr size_t type_size = sizeof(T);
+    void parent_after_fork()
+    {
+        mutex.unlock();
+    }
 
-    inblock_allocator() noexcept
+    void child_after_fork() noexcept
     {
-        //BOOST_LOG_TRIVIAL(info) << "Constructing allocator";
+        mutex.reset_after_fork();
     }
 
-    inblock_allocator(const inblock_allocator<T, HeapHolder> &) noexcept
+    /// Whether chunk list heap finds free gaps in a gap_bitmap instead of walking the chunks.
+    bool uses_gap_bitmap() const
     {
-        //BOOST_LOG_TRIVIAL(info) << "Copy-constructing allocator";
+        return gap_bitmap_enabled && strategy == allocation_strategy::chunk_list;
     }
 
-    ~inblock_allocator() noexcept
+    /**
+     * Indexes free granules of chunk list heap in a bitmap of one bit per
+     * alignment bytes, so allocation scans dense words instead of chunk
+     * headers. The chosen gaps stay the same. An initialized heap builds the
+     * bitmap right away.
+     */
+    void set_gap_bitmap(bool value)
     {
-        //BOOST_LOG_TRIVIAL(info) << "Destructing allocator";
+        gap_bitmap_enabled = value;
+        if (size != 0) {
+            build_gap_bitmap();
+        }
     }
 
-    bool operator==(const inblock_allocator &) const
+    const gap_bitmap & get_gap_bitmap() const
     {
-        return true;
+        return gaps;
     }
 
-    bool operator!=(const inblock_allocator &) const
+    /// Whether single small objects are served from slabs, see slab_pool.
+    bool uses_slab_pools() const
     {
-        return false;
+        return slab_pools && strategy != allocation_strategy::monotonic;
     }
 
-    T * allocate(size_t n)
+    /// Should be set before anything is allocated from the heap.
+    void set_slab_pools(bool value)
     {
-        size_t bytes_num = byte_count(n);
-        bytes_num = align_size_up(bytes_num);
+        slab_pools = value;
+    }
 
-        //BOOST_LOG_TRIVIAL(debug) << "Allocating " << bytes_num << " bytes.";
+    /// Whether small arrays go to slabs as well, see set_sized_slots.
+    bool uses_sized_slots() const
+    {
+        return sized_slots && uses_slab_pools();
+    }
 
-        chunk_t *new_chunk = allocate_chunk(bytes_num);
-        if (!new_chunk) {
-            throw allocator_exception{"Run out of memory"};
+    /**
+     * Serves every block of up to slab_pool::max_slot_size bytes from slabs,
+     * not only single objects. The slot has no header, its size class is
+     * derived from the size it is freed with, so deallocate has to get the
+     * exact count passed to allocate. Needs slab pools, should be set before
+     * anything is allocated from the heap.
+     */
+    void set_sized_slots(bool value)
+    {
+        sized_slots = value;
+    }
+
+    /// Whether the heap maps new regions when its own memory is exhausted, see region_list.
+    bool is_growable() const
+    {
+        return growable && strategy != allocation_strategy::monotonic;
+    }
+
+    /**
+     * Should be set before anything is allocated from the heap. Monotonic heap
+     * does not grow, its memory is released only by reset and rewind.
+     */
+    void set_growable(bool value)
+    {
+        growable = value;
+    }
+
+    const region_list & get_regions() const
+    {
+        return regions;
+    }
+
+    /**
+     * Unmaps regions of growable heap that have no live blocks.
+     * @return Number of bytes unmapped.
+     */
+    size_t release_empty_regions()
+    {
+        std::unique_lock<heap_mutex> guard{mutex, std::defer_lock};
+        if (thread_safe) {
+            guard.lock();
         }
+        return regions.release_empty();
+    }
 
-        new_chunk->used = true;
-        return reinterpret_cast<T *>(get_chunk_data(new_chunk));
+    /// Blocks of at least this size get mappings of their own, 0 when turned off.
+    size_t get_direct_map_threshold() const
+    {
+        return direct_map_threshold;
     }
 
-    void deallocate(T *ptr, size_t n) noexcept
+    /**
+     * Serves blocks of at least given size from their own mappings, see
+     * direct_mapping_list. Should be set before anything is allocated from
+     * the heap, blocks are told apart by the size they are freed with.
+     * Monotonic heap keeps every block in its memory.
+     * @param value 0 turns it off, smaller sizes are raised to the page size.
+     */
+    void set_direct_map_threshold(size_t value)
     {
-        (void)n;
-        chunk_t *freed_chunk = get_chunk_from_payload_addr(reinterpret_cast<address_t>(ptr));
-        freed_chunk->used = false;
+        direct_map_threshold = value == 0 ? 0 : std::max(value, get_page_size());
+    }
+
+    const direct_mapping_list & get_direct_mappings() const
+    {
+        return direct_mappings;
+    }
 
-        if (!remove_from_list(freed_chunk)) {
-            //BOOST_LOG_TRIVIAL(warning) << "Chunk to deallocate was not found in list";
+    const purge_policy_t & get_purge_policy() const
+    {
+        return purge_policy;
+    }
+
+    void set_purge_policy(const purge_policy_t &value)
+    {
+        purge_policy = value;
+    }
+
+    /**
+     * Gives pages of free gaps back to the system. The memory stays mapped and
+     * part of the heap, purged pages read as zeros or keep their content until
+     * they are reused. Gaps smaller than purge_policy_t::min_gap are skipped.
+     * @return Number of bytes released.
+     */
+    size_t purge()
+    {
+        std::unique_lock<heap_mutex> guard{mutex, std::defer_lock};
+        if (thread_safe) {
+            guard.lock();
         }
+        return purge_free_space();
     }
 
-    const chunk_t * get_chunk_list() const
+    bool is_stats_enabled() const
     {
-        return chunk_list;
+        return stats_enabled;
     }
 
-private:
-    const address_t heap_start_addr = heap_type::get_start_addr();
-    const address_t heap_end_addr = heap_type::get_end_addr();
-    const size_t heap_size = heap_type::get_size();
-    chunk_list_t &chunk_list = heap_type::chunk_list;
+    /// Counters are kept only while enabled, a disabled heap pays one branch per block.
+    void set_stats_enabled(bool value)
+    {
+        stats_enabled = value;
+    }
+
+    void reset_stats()
+    {
+        counters = heap_counters_t{};
+    }
+
+    trace_recorder * get_trace_recorder() const
+    {
+        return recorder;
+    }
 
-    chunk_t * allocate_chunk(size_t payload_size)
+    /// Allocators record their operations into given recorder, nullptr stops the recording.
+    void set_trace_recorder(trace_recorder *value)
     {
-        if (!chunk_list) {
-            chunk_list = initialize_chunk(heap_start_addr, payload_size);
-            return chunk_list;
+        recorder = value;
+    }
+
+    /// Walks the heap for the free space figures and adds the collected counters.
+    heap_stats_t get_stats()
+    {
+        std::unique_lock<heap_mutex> guard{mutex, std::defer_lock};
+        if (thread_safe) {
+            guard.lock();
         }
 
-        chunk_t *chunk = nullptr;
+        heap_stats_t stats;
+        stats.heap_size = size;
+        stats.counters = counters;
+        auto add_free_gap = [&stats](size_t gap) {
+            stats.free_bytes += gap;
+            if (gap > stats.largest_free_gap) {
+                stats.largest_free_gap = gap;
+            }
+        };
 
-        chunk = try_to_allocate_before_first_chunk(payload_size);
-        if (chunk) {
-            return chunk;
+        if (strategy == allocation_strategy::tlsf) {
+            tlsf.for_each_block([&](void *, size_t block_size, bool used) {
+                if (used) {
+                    stats.used_blocks++;
+                }
+                else {
+                    add_free_gap(block_size);
+                }
+            });
+        }
+        else if (strategy == allocation_strategy::monotonic) {
+            stats.used_blocks = counters.live_blocks;
+            add_free_gap(end_addr - bump_addr);
+        }
+        else {
+            for_each_chunk([&](void *, size_t payload_size, bool used) {
+                if (used) {
+                    stats.used_blocks++;
+                }
+                else {
+                    add_free_gap(payload_size);
+                }
+            });
         }
 
-        chunk_t *last_chunk = nullptr;
-        std::tie(chunk, last_chunk) = try_to_allocate_between_chunks(payload_size);
-        if (chunk) {
-            return chunk;
+        stats.region_count = regions.get_count();
+        stats.region_bytes = regions.get_mapped_size();
+        regions.for_each_block([&](void *, size_t block_size, bool used) {
+            if (used) {
+                stats.used_blocks++;
+            }
+            else {
+                add_free_gap(block_size);
+            }
+        });
+        stats.direct_count = direct_mappings.get_count();
+        stats.direct_bytes = direct_mappings.get_mapped_size();
+        stats.used_blocks += direct_mappings.get_count();
+        return stats;
+    }
+
+    /**
+     * Visits every chunk of chunk list heap in address order.
+     * @param func Called as func(payload_ptr, payload_size, used).
+     */
+    template <typename Func>
+    void for_each_chunk(Func func) const
+    {
+        assert(strategy == allocation_strategy::chunk_list);
+        for (const chunk_t *chunk = get_first_chunk(); !is_heap_end(chunk); chunk = get_next_chunk(chunk)) {
+            func(get_chunk_data(chunk), get_payload_size(chunk), is_used(chunk));
         }
-        assert(last_chunk);
+    }
+
+    size_t get_allocators_count() const
+    {
+        return allocators_count;
+    }
 
+    void increase_allocators_count()
+    {
+        allocators_count++;
+    }
 
-        chunk = try_to_allocate_after_last_chunk(payload_size, last_chunk);
-        if (chunk) {
-            return chunk;
+    void decrease_allocators_count()
+    {
+        allocators_count--;
+    }
+
+    /**
+     * (Re)initializes the heap over given memory. Everything allocated from
+     * the heap before is forgotten.
+     */
+    void operator()(void *ptr, size_t n_bytes, allocation_strategy strategy = allocation_strategy::chunk_list)
+    {
+        if (n_bytes < min_chunk_size) {
+            throw allocator_exception{"More memory needed."};
         }
 
-        return nullptr;
+        set_memory(ptr, n_bytes);
+        this->strategy = strategy;
+        reset();
     }
 
-    chunk_t *try_to_allocate_after_last_chunk(size_t payload_size, chunk_t *last_chunk)
+    /**
+     * Adopts chunk list heap laid out by an earlier initialization over the
+     * same memory, e.g. a reopened heap_file. Chunks hold sizes only, so the
+     * memory may now be mapped at a different address. The blocks used
+     * before stay used, the counters start from zero.
+     * @throws allocator_exception if the chunks do not tile the memory.
+     */
+    void attach(void *ptr, size_t n_bytes)
     {
-        assert(last_chunk);
-        assert(!last_chunk->next);
-        const size_t required_chunk_size = chunk_header_size + payload_size;
+        if (n_bytes < min_chunk_size) {
+            throw allocator_exception{"More memory needed."};
+        }
 
-        if (get_space_after_last_chunk(last_chunk) >= required_chunk_size) {
-            chunk_t *new_chunk = initialize_chunk(get_address_after_chunk(last_chunk), payload_size);
+        set_memory(ptr, n_bytes);
+        strategy = allocation_strategy::chunk_list;
+        forget_blocks();
+        if (!are_chunks_tiling_heap()) {
+            throw allocator_exception{"Heap memory does not hold consistent chunks."};
+        }
+        build_gap_bitmap();
+        set_rover(start_addr);
+    }
 
-            last_chunk->next = new_chunk;
+    /// Releases everything allocated from the heap at once.
+    void reset()
+    {
+        forget_blocks();
 
-            return new_chunk;
+        if (strategy == allocation_strategy::tlsf) {
+            tlsf.initialize(start_addr, end_addr);
+        }
+        else if (strategy == allocation_strategy::monotonic) {
+            bump_addr = start_addr;
         }
         else {
-            return nullptr;
+            initialize_chunks();
         }
+        build_gap_bitmap();
+        set_rover(start_addr);
     }
 
-    /// Returns pair<allocated_chunk, last_chunk>.
-    std::pair<chunk_t *, chunk_t *> try_to_allocate_between_chunks(size_t payload_size)
+    /// Current position of monotonic heap, see rewind and arena_scope.
+    heap_marker_t get_marker() const
     {
-        const size_t required_chunk_size = chunk_header_size + payload_size;
+        assert(strategy == allocation_strategy::monotonic);
+        return {bump_addr, counters.live_bytes, counters.live_blocks};
+    }
 
-        chunk_t *last_chunk = chunk_list;
-        chunk_t *chunk = last_chunk->next;
-        while (chunk) {
-            if (get_space_between_chunks(last_chunk, chunk) >= required_chunk_size) {
-                chunk_t *new_chunk = initialize_chunk_between(last_chunk, chunk, payload_size);
-                return std::make_pair(new_chunk, last_chunk);
-            }
-            last_chunk = chunk;
-            chunk = chunk->next;
+    /// Releases everything allocated from monotonic heap since the marker was taken.
+    void rewind(const heap_marker_t &marker)
+    {
+        assert(strategy == allocation_strategy::monotonic);
+        assert(start_addr <= marker.position && marker.position <= bump_addr);
+        bump_addr = marker.position;
+        if (stats_enabled) {
+            counters.live_bytes = marker.live_bytes;
+            counters.live_blocks = marker.live_blocks;
+        }
+    }
+
+    /**
+     * Allocates aligned payload of given size.
+     * @param payload_alignment Power of two up to max_alignment. Only blocks that
+     *        need more than the default alignment pay for the padding.
+     * @tparam FitPolicy first_fit, next_fit or best_fit, it decides for chunk list heap only.
+     * @return nullptr when there is no space left.
+     */
+    template<typename FitPolicy = first_fit>
+    void * allocate(size_t payload_size, size_t payload_alignment = alignment)
+    {
+        assert(is_power_of_two(payload_alignment) && payload_alignment <= max_alignment);
+        if (is_direct_size(payload_size)) {
+            return allocate_direct(payload_size, payload_alignment);
+        }
+        if (!thread_safe) {
+            return allocate_block<FitPolicy>(payload_size, payload_alignment);
+        }
+        // Cached blocks have the default alignment only.
+        if (payload_size <= thread_cache::max_cached_size && payload_alignment <= alignment && uses_thread_caches()) {
+            return allocate_cached(payload_size);
         }
-        return std::make_pair(nullptr, last_chunk);
+
+        std::lock_guard<heap_mutex> guard{mutex};
+        return allocate_block<FitPolicy>(payload_size, payload_alignment);
     }
 
-    chunk_t * try_to_allocate_before_first_chunk(size_t payload_size)
+    /**
+     * Returns payload to the heap.
+     * @param payload_size Same size as was passed to allocate.
+     */
+    void deallocate(void *ptr, size_t payload_size) noexcept
     {
-        const size_t required_chunk_size = chunk_header_size + payload_size;
+        if (is_direct_size(payload_size)) {
+            deallocate_direct(ptr);
+            return;
+        }
+        if (!thread_safe) {
+            deallocate_block(ptr);
+            return;
+        }
+        if (payload_size <= thread_cache::max_cached_size && uses_thread_caches()) {
+            deallocate_cached(ptr, payload_size);
+            return;
+        }
 
-        if (get_space_before_first_chunk() >= required_chunk_size) {
-            chunk_t *new_chunk = initialize_chunk(heap_start_addr, payload_size);
+        std::lock_guard<heap_mutex> guard{mutex};
+        deallocate_block(ptr);
+    }
 
-            chunk_t *old_first_chunk = chunk_list;
-            new_chunk->next = old_first_chunk;
-            chunk_list = new_chunk;
+    /**
+     * Allocates count payloads of the same size under one lock. Chunk list
+     * heap places them on one first-fit pass, next to each other wherever a
+     * free gap holds more of them. Either every payload is allocated or none.
+     * @param ptrs Receives count payloads, e.g. an array of void * or T *.
+     * @return false when there is no space left.
+     */
+    template<typename Ptr>
+    bool allocate_batch(size_t payload_size, size_t count, Ptr *ptrs, size_t payload_alignment = alignment)
+    {
+        assert(is_power_of_two(payload_alignment) && payload_alignment <= max_alignment);
+        size_t allocated = 0;
+        if (is_direct_size(payload_size)) {
+            for (; allocated < count; allocated++) {
+                ptrs[allocated] = static_cast<Ptr>(allocate_direct(payload_size, payload_alignment));
+                if (!ptrs[allocated]) {
+                    deallocate_batch(ptrs, allocated, payload_size);
+                    return false;
+                }
+            }
+            return true;
+        }
 
-            return new_chunk;
+        std::unique_lock<heap_mutex> guard{mutex, std::defer_lock};
+        if (thread_safe) {
+            guard.lock();
         }
-        else {
-            return nullptr;
+        if (strategy == allocation_strategy::chunk_list) {
+            allocated = allocate_chunk_batch(payload_size, payload_alignment, count, ptrs);
+        }
+        // Growable heap continues in its regions.
+        for (; allocated < count; allocated++) {
+            ptrs[allocated] = static_cast<Ptr>(allocate_block(payload_size, payload_alignment));
+            if (!ptrs[allocated]) {
+                for (size_t i = 0; i < allocated; i++) {
+                    deallocate_block(ptrs[i]);
+                }
+                return false;
+            }
         }
+        return true;
     }
 
-    chunk_t * initialize_chunk_between(chunk_t *first_chunk, chunk_t *second_chunk, size_t payload_size)
+    /**
+     * Returns count payloads to the heap under one lock.
+     * @param payload_size Same size as was passed to allocate_batch or allocate.
+     */
+    template<typename Ptr>
+    void deallocate_batch(const Ptr *ptrs, size_t count, size_t payload_size) noexcept
     {
-        assert(get_space_between_chunks(first_chunk, second_chunk) >= chunk_header_size + payload_size);
+        if (is_direct_size(payload_size)) {
+            for (size_t i = 0; i < count; i++) {
+                deallocate_direct(ptrs[i]);
+            }
+            return;
+        }
 
-        chunk_t *new_chunk = initialize_chunk(get_address_after_chunk(first_chunk), payload_size);
-        insert_between(first_chunk, second_chunk, new_chunk);
-        return new_chunk;
+        std::unique_lock<heap_mutex> guard{mutex, std::defer_lock};
+        if (thread_safe) {
+            guard.lock();
+        }
+        for (size_t i = 0; i < count; i++) {
+            deallocate_block(ptrs[i]);
+        }
     }
 
-    bool remove_from_list(chunk_t *chunk_to_remove) noexcept
+    /**
+     * Grows or shrinks payload without moving it.
+     * @param old_payload_size Size the payload was allocated or last resized with.
+     * @return false if there is not enough free space right after the payload
+     *         or the payload would cross the direct mapping threshold.
+     */
+    bool resize_in_place(void *ptr, size_t old_payload_size, size_t new_payload_size)
     {
-        if (!chunk_list) {
+        if (is_direct_size(old_payload_size) != is_direct_size(new_payload_size)) {
             return false;
         }
-        else if (!chunk_list->next) {
-            if (chunk_list == chunk_to_remove) {
-                chunk_list = nullptr;
-                return true;
-            }
-            else {
-                return false;
-            }
+        if (is_direct_size(old_payload_size)) {
+            return resize_direct(ptr, new_payload_size);
         }
-        else if (chunk_list == chunk_to_remove) {
-            chunk_t *second_chunk = chunk_list->next;
-            chunk_list->next = nullptr;
-            chunk_list = second_chunk;
-            return true;
+        std::unique_lock<heap_mutex> guard{mutex, std::defer_lock};
+        if (thread_safe) {
+            guard.lock();
+        }
+        if (!stats_enabled) {
+            return resize_block(ptr, old_payload_size, new_payload_size);
         }
 
-        chunk_t *last_chunk = chunk_list;
-        chunk_t *chunk = chunk_list->next;
-        while (chunk) {
-            if (chunk == chunk_to_remove) {
-                chunk_t *next = chunk->next;
-                chunk->next = nullptr;
+        size_t old_usable_size = get_usable_size(ptr, old_payload_size);
+        if (!resize_block(ptr, old_payload_size, new_payload_size)) {
+            return false;
+        }
+        counters.on_resize(old_usable_size, get_usable_size(ptr, new_payload_size));
+        return true;
+    }
 
-                if (next) {
-                    last_chunk->next = next;
-                }
-                else {
-                    last_chunk->next = nullptr;
-                }
-                return true;
+    /**
+     * Real size of the payload, it may be bigger than requested.
+     * @param payload_size Same size as was passed to allocate.
+     */
+    size_t get_usable_size(const void *ptr, size_t payload_size) const
+    {
+        if (is_direct_size(payload_size)) {
+            return direct_mapping_list::get_usable_size(ptr);
+        }
+        return get_block_usable_size(ptr, payload_size);
+    }
+
+    /**
+     * Usable size the payload can still be freed or resized with. Heap blocks are
+     * capped below the direct mapping threshold, so they are not taken for mappings.
+     * @param payload_size Same size as was passed to allocate.
+     */
+    size_t get_freeable_size(const void *ptr, size_t payload_size) const
+    {
+        size_t usable_size = get_usable_size(ptr, payload_size);
+        if (direct_map_threshold == 0 || is_direct_size(payload_size)) {
+            return usable_size;
+        }
+        return std::min(usable_size, (direct_map_threshold - 1) & ~(alignment - 1));
+    }
+
+    /**
+     * Allocates slot for one small object from a slab.
+     * @return nullptr when there is no space left.
+     */
+    void * allocate_slot(size_t payload_size)
+    {
+        assert(uses_slab_pools());
+        std::unique_lock<heap_mutex> guard{mutex, std::defer_lock};
+        if (thread_safe) {
+            guard.lock();
+        }
+
+        size_t size_class = slab_pool::get_size_class(payload_size);
+        void *slot = slabs.allocate(size_class);
+        if (!slot) {
+            void *slab = allocate_block(slab_pool::slab_block_size, slab_pool::slab_size);
+            if (!slab) {
+                return nullptr;
             }
-            last_chunk = chunk;
-            chunk = chunk->next;
+            slabs.add_slab(slab, size_class);
+            slot = slabs.allocate(size_class);
         }
-        return false;
+        return slot;
     }
 
-    address_t get_address_after_chunk(const chunk_t *chunk) const
+    void deallocate_slot(void *ptr) noexcept
     {
-        auto chunk_addr = reinterpret_cast<address_t>(chunk);
-        return chunk_addr + get_chunk_size(chunk);
+        std::unique_lock<heap_mutex> guard{mutex, std::defer_lock};
+        if (thread_safe) {
+            guard.lock();
+        }
+
+        if (void *empty_slab = slabs.deallocate(ptr)) {
+            deallocate_block(empty_slab);
+        }
     }
 
-    size_t get_space_before_first_chunk() const
+    /// Returns all blocks cached by the calling thread to the heap.
+    void flush_thread_cache() noexcept
     {
-        const chunk_t *first_chunk = chunk_list;
-        if (!first_chunk) {
-            return heap_size;
+        if (thread_cache *cache = get_thread_cache()) {
+            flush_thread_cache(*cache);
         }
-        else {
-            return diff(heap_start_addr, reinterpret_cast<address_t>(first_chunk));
+    }
+
+    void flush_thread_cache(thread_cache &cache) noexcept;
+
+    /// Flushes the cache only if the heap it was filled from still exists.
+    static void flush_thread_cache(inblock_allocator_heap *heap, thread_cache &cache) noexcept;
+
+private:
+    address_t start_addr = 0;
+    address_t end_addr = 0;
+    size_t size = 0;
+    size_t allocators_count = 0;
+    allocation_strategy strategy = allocation_strategy::chunk_list;
+    tlsf_pool tlsf;
+    address_t bump_addr = 0;
+    /// Chunk where next_fit resumes, it always points to a chunk header, see get_rover.
+    address_t rover_addr = 0;
+    /// Offset of the rover kept in shared memory, replaces rover_addr if set.
+    uint64_t *shared_rover = nullptr;
+    bool gap_bitmap_enabled = false;
+    gap_bitmap gaps;
+    slab_pool slabs;
+    bool slab_pools = false;
+    bool sized_slots = false;
+    bool growable = false;
+    region_list regions;
+    size_t direct_map_threshold = 0;
+    direct_mapping_list direct_mappings;
+    bool thread_safe = false;
+    bool thread_caches = true;
+    bool stats_enabled = false;
+    heap_counters_t counters;
+    purge_policy_t purge_policy;
+    size_t freed_since_purge = 0;
+    trace_recorder *recorder = nullptr;
+    heap_mutex mutex;
+    /// Unique for every initialization of every heap, so thread caches can spot stale blocks.
+    uint64_t generation = 0;
+    /// Link in the list of live heaps, see is_live.
+    inblock_allocator_heap *next_live = nullptr;
+
+    static uint64_t next_generation();
+    static bool is_live(const inblock_allocator_heap *heap, uint64_t generation);
+
+    /// @return nullptr if the calling thread already caches blocks of too many heaps.
+    thread_cache * get_thread_cache();
+    void * allocate_cached(size_t payload_size);
+    void deallocate_cached(void *ptr, size_t payload_size) noexcept;
+
+    void set_memory(void *ptr, size_t n_bytes)
+    {
+        auto intptr = reinterpret_cast<address_t>(ptr);
+        start_addr = align_addr_up(intptr, alignment);
+        end_addr = align_addr_down(intptr + n_bytes, alignment);
+        size = diff(end_addr, start_addr);
+    }
+
+    /// Drops the state kept outside of the heap memory.
+    void forget_blocks()
+    {
+        slabs.reset();
+        regions.release_all();
+        direct_mappings.release_all();
+        counters.live_bytes = 0;
+        counters.live_blocks = 0;
+        freed_since_purge = 0;
+        generation = next_generation();
+    }
+
+    bool is_direct_size(size_t payload_size) const
+    {
+        return direct_map_threshold != 0 && payload_size >= direct_map_threshold &&
+               strategy != allocation_strategy::monotonic;
+    }
+
+    /// Maps outside of the lock, other threads wait only while the mapping is linked in.
+    void * allocate_direct(size_t payload_size, size_t payload_alignment)
+    {
+        void *ptr = direct_mapping_list::map(payload_size, payload_alignment);
+        std::unique_lock<heap_mutex> guard{mutex, std::defer_lock};
+        if (thread_safe) {
+            guard.lock();
+        }
+        if (ptr) {
+            direct_mappings.add(ptr);
         }
+        if (stats_enabled) {
+            counters.allocation_sizes.record(payload_size);
+            if (ptr) {
+                counters.on_allocate(direct_mapping_list::get_usable_size(ptr));
+            }
+            else {
+                counters.failed_allocations++;
+            }
+        }
+        return ptr;
     }
 
-    size_t get_space_between_chunks(const chunk_t *first_chunk, const chunk_t *second_chunk) const
+    void deallocate_direct(void *ptr) noexcept
     {
-        auto first_chunk_end = reinterpret_cast<address_t>(first_chunk) + get_chunk_size(first_chunk);
-        auto second_chunk_start = reinterpret_cast<address_t>(second_chunk);
-        return diff(first_chunk_end, second_chunk_start);
+        {
+            std::unique_lock<heap_mutex> guard{mutex, std::defer_lock};
+            if (thread_safe) {
+                guard.lock();
+            }
+            direct_mappings.remove(ptr);
+            if (stats_enabled) {
+                counters.on_deallocate(direct_mapping_list::get_usable_size(ptr));
+            }
+        }
+        direct_mapping_list::unmap(ptr);
     }
 
-    size_t get_space_after_last_chunk(const chunk_t *last_chunk) const
+    /// Remaps outside of the lock as well, only the accounting is locked.
+    bool resize_direct(void *ptr, size_t new_payload_size)
     {
-        auto last_chunk_end = reinterpret_cast<address_t>(last_chunk) + get_chunk_size(last_chunk);
-        return diff(last_chunk_end, heap_end_addr);
+        size_t old_usable_size = direct_mapping_list::get_usable_size(ptr);
+        if (!direct_mapping_list::remap(ptr, new_payload_size)) {
+            return false;
+        }
+        std::unique_lock<heap_mutex> guard{mutex, std::defer_lock};
+        if (thread_safe) {
+            guard.lock();
+        }
+        direct_mappings.resized(ptr, old_usable_size);
+        if (stats_enabled) {
+            counters.on_resize(old_usable_size, direct_mapping_list::get_usable_size(ptr));
+        }
+        return true;
     }
 
-    void insert_between(chunk_t *first_chunk, chunk_t *second_chunk, chunk_t *chunk_to_insert) const
+    /// Usable size of block managed by the engine or the regions.
+    size_t get_block_usable_size(const void *ptr, size_t payload_size) const
     {
-        assert(first_chunk->next == second_chunk);
+        if (is_growable() && !is_in_first_region(ptr)) {
+            return tlsf_pool::get_usable_size(ptr);
+        }
+        if (strategy == allocation_strategy::tlsf) {
+            return tlsf_pool::get_usable_size(ptr);
+        }
+        else if (strategy == allocation_strategy::monotonic) {
+            return payload_size;
+        }
+        return get_payload_size(get_chunk_from_payload_addr(reinterpret_cast<address_t>(ptr)));
+    }
 
-        first_chunk->next = chunk_to_insert;
-        chunk_to_insert->next = second_chunk;
+    template<typename FitPolicy = first_fit>
+    void * allocate_block(size_t payload_size, size_t payload_alignment = alignment)
+    {
+        void *ptr = allocate_from_engine<FitPolicy>(payload_size, payload_alignment);
+        if (!ptr && is_growable()) {
+            ptr = regions.allocate(payload_size, payload_alignment);
+        }
+        record_allocation(ptr, payload_size);
+        return ptr;
     }
 
-    size_t byte_count(size_t type_count) const
+    /// @param ptr Block of the engine or the regions, nullptr for failed allocation.
+    void record_allocation(const void *ptr, size_t payload_size)
     {
-        return type_size * type_count;
+        if (!stats_enabled) {
+            return;
+        }
+        counters.allocation_sizes.record(payload_size);
+        if (!ptr) {
+            counters.failed_allocations++;
+            return;
+        }
+        size_t usable_size = get_block_usable_size(ptr, align_size_up(payload_size));
+        counters.on_allocate(usable_size);
+        if (is_in_first_region(ptr)) {
+            counters.high_water_mark = std::max(counters.high_water_mark,
+                                                reinterpret_cast<address_t>(ptr) + usable_size - start_addr);
+        }
     }
-};
+
+    template<typename FitPolicy>
+    void * allocate_from_engine(size_t payload_size, size_t payload_alignment)
+    {
+        if (strategy == allocation_strategy::tlsf) {
+            return tlsf.allocate(payload_size, payload_alignment);
+        }
+        else if (strategy == allocation_strategy::monotonic) {
+            return bump(payload_size, payload_alignment);
+        }
+
+        chunk_t *new_chunk = allocate_chunk(payload_size, payload_alignment, FitPolicy{});
+        if (!new_chunk) {
+            return nullptr;
+        }
+        return get_chunk_data(new_chunk);
+    }
+
+    void deallocate_block(void *ptr) noexcept
+    {
+        size_t freed_size = deallocate_from_engine(ptr);
+        if (freed_size == 0) {
+            return;
+        }
+        if (stats_enabled) {
+            counters.on_deallocate(freed_size);
+        }
+        if (purge_policy.decay_bytes != 0) {
+            freed_since_purge += freed_size;
+            if (freed_since_purge >= purge_policy.decay_bytes) {
+                purge_free_space();
+            }
+        }
+    }
+
+    /// @return Usable size of the freed block, 0 if nothing was freed.
+    size_t deallocate_from_engine(void *ptr) noexcept
+    {
+        if (is_growable() && !is_in_first_region(ptr)) {
+            size_t freed_size = tlsf_pool::get_usable_size(ptr);
+            regions.deallocate(ptr);
+            return freed_size;
+        }
+        if (strategy == allocation_strategy::tlsf) {
+            size_t freed_size = tlsf_pool::get_usable_size(ptr);
+            tlsf.deallocate(ptr);
+            return freed_size;
+        }
+        else if (strategy == allocation_strategy::monotonic) {
+            return 0;
+        }
+
+        chunk_t *freed_chunk = get_chunk_from_payload_addr(reinterpret_cast<address_t>(ptr));
+        if (!is_used(freed_chunk)) {
+            //BOOST_LOG_TRIVIAL(warning) << "Chunk to deallocate is not used";
+            return 0;
+        }
+
+        size_t freed_size = get_payload_size(freed_chunk);
+        set_used(freed_chunk, false);
+        mark_chunk(freed_chunk, true);
+        merge_free_chunk(freed_chunk);
+        return freed_size;
+    }
+
+    size_t purge_free_space() noexcept
+    {
+        freed_since_purge = 0;
+        size_t purged = 0;
+        auto purge_gap = [this, &purged](address_t begin, address_t end) {
+            if (end - begin >= purge_policy.min_gap) {
+                purged += purge_memory(begin, end, purge_policy.lazy);
+            }
+        };
+        // Free TLSF blocks keep their list links at the start of the payload.
+        auto purge_tlsf_block = [&purge_gap](void *payload, size_t block_size, bool used) {
+            auto payload_addr = reinterpret_cast<address_t>(payload);
+            if (!used) {
+                purge_gap(payload_addr + tlsf_pool::free_links_size, payload_addr + block_size);
+            }
+        };
+
+        if (strategy == allocation_strategy::tlsf) {
+            tlsf.for_each_block(purge_tlsf_block);
+        }
+        else if (strategy == allocation_strategy::monotonic) {
+            purge_gap(bump_addr, end_addr);
+        }
+        else {
+            for_each_chunk([&purge_gap](void *payload, size_t payload_size, bool used) {
+                auto payload_addr = reinterpret_cast<address_t>(payload);
+                if (!used) {
+                    purge_gap(payload_addr, payload_addr + payload_size);
+                }
+            });
+        }
+        regions.for_each_block(purge_tlsf_block);
+
+        if (stats_enabled) {
+            counters.purges++;
+            counters.purged_bytes += purged;
+        }
+        return purged;
+    }
+
+    bool resize_block(void *ptr, size_t old_payload_size, size_t new_payload_size)
+    {
+        auto payload_addr = reinterpret_cast<address_t>(ptr);
+        if (is_growable() && !is_in_first_region(ptr)) {
+            return regions.resize_in_place(ptr, new_payload_size);
+        }
+        if (strategy == allocation_strategy::tlsf) {
+            return tlsf.resize_in_place(ptr, new_payload_size);
+        }
+        else if (strategy == allocation_strategy::monotonic) {
+            // Only the most recent block borders free space.
+            if (payload_addr + align_size_up(old_payload_size == 0 ? 1 : old_payload_size) != bump_addr) {
+                return new_payload_size <= old_payload_size;
+            }
+            new_payload_size = align_size_up(new_payload_size == 0 ? 1 : new_payload_size);
+            if (end_addr - payload_addr < new_payload_size) {
+                return false;
+            }
+            bump_addr = payload_addr + new_payload_size;
+            return true;
+        }
+
+        chunk_t *chunk = get_chunk_from_payload_addr(payload_addr);
+        assert(is_used(chunk));
+        new_payload_size = std::max(align_size_up(new_payload_size), min_payload_size);
+        if (new_payload_size > get_payload_size(chunk)) {
+            chunk_t *next = get_next_chunk(chunk);
+            if (is_heap_end(next) || is_used(next) || !can_merge(chunk, next) ||
+                get_payload_size(chunk) + get_chunk_size(next) < new_payload_size) {
+                return false;
+            }
+            absorb(chunk, next);
+            mark_chunk(chunk, false);
+        }
+        if (get_payload_size(chunk) - new_payload_size >= chunk_header_size) {
+            chunk_t *rest = split_chunk(chunk, new_payload_size);
+            mark_chunk(rest, true);
+            merge_free_chunk(rest);
+        }
+        return true;
+    }
+
+    void * bump(size_t payload_size, size_t payload_alignment)
+    {
+        payload_size = align_size_up(payload_size == 0 ? 1 : payload_size);
+        address_t payload_addr = align_addr_up(bump_addr, payload_alignment);
+        if (payload_addr > end_addr || end_addr - payload_addr < payload_size) {
+            return nullptr;
+        }
+
+        bump_addr = payload_addr + payload_size;
+        return reinterpret_cast<void *>(payload_addr);
+    }
+
+    /// Tiles the heap with free chunks, there is more than one only if the heap exceeds max_payload_size.
+    void initialize_chunks()
+    {
+        address_t chunk_addr = start_addr;
+        size_t prev_payload_size = 0;
+        while (end_addr - chunk_addr >= chunk_header_size) {
+            size_t payload_size = std::min(end_addr - chunk_addr - chunk_header_size, max_payload_size);
+            chunk_t *chunk = initialize_chunk(chunk_addr, payload_size);
+            set_prev_payload_size(chunk, prev_payload_size);
+            prev_payload_size = payload_size;
+            chunk_addr += get_chunk_size(chunk);
+        }
+    }
+
+    /// Every chunk fits into the heap, agrees with its neighbour and the last one ends at the heap end.
+    bool are_chunks_tiling_heap() const
+    {
+        address_t chunk_addr = start_addr;
+        size_t prev_payload_size = 0;
+        while (chunk_addr < end_addr) {
+            auto chunk = reinterpret_cast<const chunk_t *>(chunk_addr);
+            if (end_addr - chunk_addr < chunk_header_size || get_chunk_size(chunk) > end_addr - chunk_addr ||
+                get_prev_payload_size(chunk) != prev_payload_size) {
+                return false;
+            }
+            prev_payload_size = get_payload_size(chunk);
+            chunk_addr += get_chunk_size(chunk);
+        }
+        return true;
+    }
+
+    chunk_t * allocate_chunk(size_t payload_size, size_t payload_alignment, first_fit)
+    {
+        payload_size = std::max(align_size_up(payload_size), min_payload_size);
+        size_t walk_length = 0;
+        chunk_t *chunk = place_first_fit(start_addr, end_addr, payload_size, payload_alignment, walk_length);
+        record_walk(walk_length);
+        return chunk;
+    }
+
+    address_t get_rover() const
+    {
+        return shared_rover ? start_addr + *shared_rover : rover_addr;
+    }
+
+    void set_rover(address_t addr)
+    {
+        if (shared_rover) {
+            *shared_rover = addr - start_addr;
+        }
+        else {
+            rover_addr = addr;
+        }
+    }
+
+    chunk_t * allocate_chunk(size_t payload_size, size_t payload_alignment, next_fit)
+    {
+        payload_size = std::max(align_size_up(payload_size), min_payload_size);
+        size_t walk_length = 0;
+        address_t rover = get_rover();
+        chunk_t *chunk = place_first_fit(rover, end_addr, payload_size, payload_alignment, walk_length);
+        if (!chunk) {
+            chunk = place_first_fit(start_addr, rover, payload_size, payload_alignment, walk_length);
+        }
+        record_walk(walk_length);
+        if (chunk) {
+            chunk_t *next = get_next_chunk(chunk);
+            set_rover(is_heap_end(next) ? start_addr : reinterpret_cast<address_t>(next));
+        }
+        return chunk;
+    }
+
+    chunk_t * allocate_chunk(size_t payload_size, size_t payload_alignment, best_fit)
+    {
+        payload_size = std::max(align_size_up(payload_size), min_payload_size);
+        size_t walk_length = 0;
+        chunk_t *best = nullptr;
+        chunk_t *chunk = find_free_chunk(start_addr, end_addr, payload_size, walk_length);
+        while (chunk) {
+            if (can_place_chunk(chunk, payload_size, payload_alignment) &&
+                (!best || get_payload_size(chunk) < get_payload_size(best))) {
+                best = chunk;
+                if (get_payload_size(best) == payload_size) {
+                    break;
+                }
+            }
+            walk_length++;
+            chunk = find_free_chunk(reinterpret_cast<address_t>(get_next_chunk(chunk)), end_addr, payload_size,
+                                    walk_length);
+        }
+        record_walk(walk_length);
+        return best ? try_to_place_chunk(best, payload_size, payload_alignment) : nullptr;
+    }
+
+    /**
+     * First-fit pass that carves as many chunks as fit out of every free
+     * chunk it meets, the rest of a gap follows right after the placed chunk.
+     * @return Number of payloads stored to ptrs, less than count when the heap is full.
+     */
+    template<typename Ptr>
+    size_t allocate_chunk_batch(size_t payload_size, size_t payload_alignment, size_t count, Ptr *ptrs)
+    {
+        size_t chunk_payload_size = std::max(align_size_up(payload_size), min_payload_size);
+        size_t walk_length = 0;
+        size_t allocated = 0;
+        chunk_t *free_chunk = count == 0 ? nullptr : find_free_chunk(start_addr, end_addr, chunk_payload_size,
+                                                                      walk_length);
+        while (free_chunk) {
+            chunk_t *chunk = try_to_place_chunk(free_chunk, chunk_payload_size, payload_alignment);
+            if (!chunk) {
+                walk_length++;
+                free_chunk = find_free_chunk(reinterpret_cast<address_t>(get_next_chunk(free_chunk)), end_addr,
+                                             chunk_payload_size, walk_length);
+                continue;
+            }
+
+            ptrs[allocated] = static_cast<Ptr>(get_chunk_data(chunk));
+            record_allocation(ptrs[allocated], payload_size);
+            if (++allocated == count) {
+                break;
+            }
+            chunk_t *next = get_next_chunk(chunk);
+            if (!is_heap_end(next) && !is_used(next)) {
+                free_chunk = next;
+            }
+            else {
+                free_chunk = find_free_chunk(reinterpret_cast<address_t>(next), end_addr, chunk_payload_size,
+                                             walk_length);
+            }
+        }
+        record_walk(walk_length);
+        return allocated;
+    }
+
+    /// Places the chunk into the first free chunk that starts in [from_addr, until_addr) and fits.
+    chunk_t * place_first_fit(address_t from_addr, address_t until_addr, size_t payload_size,
+                              size_t payload_alignment, size_t &walk_length)
+    {
+        chunk_t *chunk = find_free_chunk(from_addr, until_addr, payload_size, walk_length);
+        while (chunk) {
+            if (chunk_t *new_chunk = try_to_place_chunk(chunk, payload_size, payload_alignment)) {
+                return new_chunk;
+            }
+            walk_length++;
+            chunk = find_free_chunk(reinterpret_cast<address_t>(get_next_chunk(chunk)), until_addr, payload_size,
+                                    walk_length);
+        }
+        return nullptr;
+    }
+
+    /**
+     * First free chunk starting in [from_addr, until_addr) that is big enough
+     * before alignment is taken into account. The walk counts every chunk it
+     * steps over, the gap bitmap skips them without looking. Runs of free
+     * granules begin at chunk headers, a run spans more chunks only if they
+     * were too big to merge.
+     * @param from_addr Chunk header or the heap end.
+     */
+    chunk_t * find_free_chunk(address_t from_addr, address_t until_addr, size_t payload_size, size_t &walk_length)
+    {
+        if (uses_gap_bitmap()) {
+            size_t granule = gaps.find_run((from_addr - start_addr) / alignment,
+                                           (chunk_header_size + payload_size) / alignment);
+            if (granule == gap_bitmap::npos || start_addr + granule * alignment >= until_addr) {
+                return nullptr;
+            }
+            return reinterpret_cast<chunk_t *>(start_addr + granule * alignment);
+        }
+
+        for (auto chunk = reinterpret_cast<chunk_t *>(from_addr);
+             reinterpret_cast<address_t>(chunk) < until_addr; chunk = get_next_chunk(chunk)) {
+            if (!is_used(chunk) && get_payload_size(chunk) >= payload_size) {
+                return chunk;
+            }
+            walk_length++;
+        }
+        return nullptr;
+    }
+
+    /// Sets the bits of free chunks, the bitmap is dropped when it is not used.
+    void build_gap_bitmap()
+    {
+        if (!uses_gap_bitmap()) {
+            gaps.release();
+            return;
+        }
+        gaps.assign(size / alignment);
+        for_each_chunk([this](void *payload, size_t, bool used) {
+            if (!used) {
+                mark_chunk(get_chunk_from_payload_addr(reinterpret_cast<address_t>(payload)), true);
+            }
+        });
+    }
+
+    /// Keeps the gap bitmap in sync after given chunk became free or used, header included.
+    void mark_chunk(const chunk_t *chunk, bool free)
+    {
+        if (uses_gap_bitmap()) {
+            size_t first_granule = (reinterpret_cast<address_t>(chunk) - start_addr) / alignment;
+            gaps.assign_range(first_granule, first_granule + get_chunk_size(chunk) / alignment, free);
+        }
+    }
+
+    void record_walk(size_t walk_length)
+    {
+        if (stats_enabled) {
+            counters.walk_lengths.record(walk_length);
+        }
+    }
+
+    static bool can_place_chunk(const chunk_t *free_chunk, size_t payload_size, size_t payload_alignment)
+    {
+        auto free_payload_addr = reinterpret_cast<address_t>(get_chunk_data(free_chunk));
+        address_t free_end = free_payload_addr + get_payload_size(free_chunk);
+        address_t payload_addr = align_addr_up(free_payload_addr, payload_alignment);
+        return payload_addr <= free_end && free_end - payload_addr >= payload_size;
+    }
+
+    /// Places used chunk into the free one, space in front of and after it stays free.
+    chunk_t * try_to_place_chunk(chunk_t *free_chunk, size_t payload_size, size_t payload_alignment)
+    {
+        if (!can_place_chunk(free_chunk, payload_size, payload_alignment)) {
+            return nullptr;
+        }
+        auto free_payload_addr = reinterpret_cast<address_t>(get_chunk_data(free_chunk));
+        address_t payload_addr = align_addr_up(free_payload_addr, payload_alignment);
+
+        chunk_t *chunk = free_chunk;
+        if (payload_addr != free_payload_addr) {
+            // Both addresses are aligned, so the leading gap can hold at least a header.
+            chunk = split_chunk(free_chunk, payload_addr - free_payload_addr - chunk_header_size);
+        }
+        if (get_payload_size(chunk) - payload_size >= chunk_header_size) {
+            split_chunk(chunk, payload_size);
+        }
+        set_used(chunk, true);
+        mark_chunk(chunk, false);
+        return chunk;
+    }
+
+    /**
+     * Splits chunk after given size of payload.
+     * @return The second part, a free chunk.
+     */
+    chunk_t * split_chunk(chunk_t *chunk, size_t payload_size)
+    {
+        assert(get_payload_size(chunk) >= payload_size + chunk_header_size);
+        size_t rest_payload_size = get_payload_size(chunk) - payload_size - chunk_header_size;
+        set_payload_size(chunk, payload_size);
+
+        chunk_t *rest = initialize_chunk(reinterpret_cast<address_t>(get_next_chunk(chunk)), rest_payload_size);
+        set_prev_payload_size(rest, payload_size);
+        update_next_prev_size(rest);
+        return rest;
+    }
+
+    /// Merges free chunk with its free neighbours in constant time.
+    chunk_t * merge_free_chunk(chunk_t *chunk)
+    {
+        chunk_t *next = get_next_chunk(chunk);
+        if (!is_heap_end(next) && !is_used(next) && can_merge(chunk, next)) {
+            absorb(chunk, next);
+        }
+        if (!is_first_chunk(chunk)) {
+            chunk_t *prev = get_prev_chunk(chunk);
+            if (!is_used(prev) && can_merge(prev, chunk)) {
+                absorb(prev, chunk);
+                chunk = prev;
+            }
+        }
+        return chunk;
+    }
+
+    static bool can_merge(const chunk_t *chunk, const chunk_t *next)
+    {
+        return get_payload_size(chunk) + get_chunk_size(next) <= max_payload_size;
+    }
+
+    /// Makes the next chunk part of the payload of given chunk.
+    void absorb(chunk_t *chunk, const chunk_t *next)
+    {
+        // The header of the next chunk is gone, next_fit resumes at the merged chunk.
+        if (get_rover() == reinterpret_cast<address_t>(next)) {
+            set_rover(reinterpret_cast<address_t>(chunk));
+        }
+        set_payload_size(chunk, get_payload_size(chunk) + get_chunk_size(next));
+        update_next_prev_size(chunk);
+    }
+
+    /// Keeps the boundary tag of the following chunk in sync after the size of given chunk changed.
+    void update_next_prev_size(const chunk_t *chunk)
+    {
+        chunk_t *next = get_next_chunk(chunk);
+        if (!is_heap_end(next)) {
+            set_prev_payload_size(next, get_payload_size(chunk));
+        }
+    }
+
+    /// Memory given to operator() as opposed to the mapped regions.
+    bool is_in_first_region(const void *ptr) const
+    {
+        auto addr = reinterpret_cast<address_t>(ptr);
+        return start_addr <= addr && addr < end_addr;
+    }
+
+    chunk_t * get_first_chunk() const
+    {
+        return reinterpret_cast<chunk_t *>(start_addr);
+    }
+
+    bool is_first_chunk(const chunk_t *chunk) const
+    {
+        return reinterpret_cast<address_t>(chunk) == start_addr;
+    }
+
+    bool is_heap_end(const chunk_t *chunk) const
+    {
+        return reinterpret_cast<address_t>(chunk) >= end_addr;
+    }
+};
+
+/**
+ * Rewinds a monotonic heap to the position it had when the scope was entered,
+ * so a phase drops all its temporaries at once. Scopes can be nested.
+ */
+class arena_scope {
+public:
+    explicit arena_scope(inblock_allocator_heap &heap)
+        : heap{heap},
+          marker{heap.get_marker()}
+    {}
+
+    ~arena_scope()
+    {
+        heap.rewind(marker);
+    }
+
+    arena_scope(const arena_scope &) = delete;
+    arena_scope & operator=(const arena_scope &) = delete;
+
+private:
+    inblock_allocator_heap &heap;
+    const heap_marker_t marker;
+};
+
+/**
+ * Standard allocator over the heap of HeapHolder::heap.
+ * @tparam FitPolicy first_fit, next_fit or best_fit, the chunk a block of
+ *         chunk list heap is placed into. Allocators with different policies
+ *         may share one heap.
+ */
+template<typename T, typename HeapHolder, typename FitPolicy = first_fit>
+class inblock_allocator {
+public:
+    using value_type = T;
+    using heap_type = decltype(HeapHolder::heap);
+    static constexpr size_t type_size = sizeof(T);
+    static constexpr size_t type_alignment = alignof(T);
+
+    static_assert(type_alignment <= max_alignment, "Alignment of the type is not supported");
+
+    /// Node containers allocate their nodes by an allocator rebound to the node type.
+    template<typename U>
+    struct rebind {
+        using other = inblock_allocator<U, HeapHolder, FitPolicy>;
+    };
+
+    /// All allocators of one heap are interchangeable.
+    using is_always_equal = std::true_type;
+
+    inblock_allocator() noexcept
+    {
+        //BOOST_LOG_TRIVIAL(info) << "Constructing allocator";
+    }
+
+    inblock_allocator(const inblock_allocator &) noexcept
+    {
+        //BOOST_LOG_TRIVIAL(info) << "Copy-constructing allocator";
+    }
+
+    template<typename U>
+    inblock_allocator(const inblock_allocator<U, HeapHolder, FitPolicy> &) noexcept
+    {}
+
+    ~inblock_allocator() noexcept
+    {
+        //BOOST_LOG_TRIVIAL(info) << "Destructing allocator";
+    }
+
+    template<typename U>
+    bool operator==(const inblock_allocator<U, HeapHolder, FitPolicy> &) const
+    {
+        return true;
+    }
+
+    template<typename U>
+    bool operator!=(const inblock_allocator<U, HeapHolder, FitPolicy> &) const
+    {
+        return false;
+    }
+
+    T * allocate(size_t n)
+    {
+        T *ptr = allocate_from_heap(n, type_alignment);
+        if (trace_recorder *recorder = HeapHolder::heap.get_trace_recorder()) {
+            recorder->record_allocate(ptr, byte_count(n));
+        }
+        return ptr;
+    }
+
+    /// Result of allocate_at_least, count is the number of objects that fit into the payload.
+    struct allocation_result {
+        T *ptr;
+        size_t count;
+    };
+
+    /// Allocates space for at least n objects and tells how many really fit, the count may be passed to deallocate.
+    allocation_result allocate_at_least(size_t n)
+    {
+        T *ptr = allocate(n);
+        if (is_slab_object(n)) {
+            // The rest of the slot is usable only if it is freed by the bigger count from the same slab.
+            size_t slot_count = slab_pool::get_slot_size(slab_pool::get_size_class(byte_count(n))) / type_size;
+            return {ptr, is_slab_object(slot_count) ? std::max(n, slot_count) : n};
+        }
+        size_t usable_size = HeapHolder::heap.get_freeable_size(ptr, align_size_up(byte_count(n)));
+        return {ptr, std::max(n, usable_size / type_size)};
+    }
+
+    /**
+     * Grows the payload to new_n objects without moving it.
+     * @param n Count the payload was allocated or last resized with.
+     * @return false if the space after the payload is not free.
+     */
+    bool try_expand(T *ptr, size_t n, size_t new_n)
+    {
+        assert(new_n >= n);
+        return resize_in_place(ptr, n, new_n);
+    }
+
+    /// Shrinks the payload to new_n objects, the rest is given back to the heap when possible.
+    bool try_shrink(T *ptr, size_t n, size_t new_n)
+    {
+        assert(new_n <= n);
+        return resize_in_place(ptr, n, new_n);
+    }
+
+    void deallocate(T *ptr, size_t n) noexcept
+    {
+        deallocate_aligned(ptr, n, type_alignment);
+    }
+
+    /**
+     * Allocates count arrays of n objects each, e.g. rows of a matrix, with one
+     * search of the heap instead of count.
+     * @param ptrs Receives count arrays, nothing is allocated if it throws.
+     */
+    void allocate_batch(size_t n, size_t count, T **ptrs)
+    {
+        if (is_slab_object(n)) {
+            for (size_t i = 0; i < count; i++) {
+                ptrs[i] = reinterpret_cast<T *>(HeapHolder::heap.allocate_slot(byte_count(n)));
+                if (!ptrs[i]) {
+                    for (size_t j = 0; j < i; j++) {
+                        HeapHolder::heap.deallocate_slot(ptrs[j]);
+                    }
+                    throw allocator_exception{"Run out of memory"};
+                }
+            }
+        }
+        else if (!HeapHolder::heap.allocate_batch(align_size_up(byte_count(n)), count, ptrs,
+                                                  std::max(type_alignment, alignment))) {
+            throw allocator_exception{"Run out of memory"};
+        }
+
+        if (trace_recorder *recorder = HeapHolder::heap.get_trace_recorder()) {
+            for (size_t i = 0; i < count; i++) {
+                recorder->record_allocate(ptrs[i], byte_count(n));
+            }
+        }
+    }
+
+    /// Returns count arrays of n objects each, allocated together or one by one.
+    void deallocate_batch(T *const *ptrs, size_t count, size_t n) noexcept
+    {
+        if (trace_recorder *recorder = HeapHolder::heap.get_trace_recorder()) {
+            for (size_t i = 0; i < count; i++) {
+                recorder->record_deallocate(ptrs[i], byte_count(n));
+            }
+        }
+        if (is_slab_object(n)) {
+            for (size_t i = 0; i < count; i++) {
+                HeapHolder::heap.deallocate_slot(ptrs[i]);
+            }
+            return;
+        }
+        HeapHolder::heap.deallocate_batch(ptrs, count, align_size_up(byte_count(n)));
+    }
+
+    /**
+     * Allocates n objects aligned to more than alignof(T), e.g. to a cache line.
+     * @param align Power of two up to max_alignment.
+     */
+    T * allocate_aligned(size_t n, size_t align)
+    {
+        if (!is_power_of_two(align) || align > max_alignment) {
+            throw allocator_exception{"Unsupported alignment"};
+        }
+        T *ptr = allocate_from_heap(n, std::max(align, type_alignment));
+        if (trace_recorder *recorder = HeapHolder::heap.get_trace_recorder()) {
+            recorder->record_allocate(ptr, byte_count(n));
+        }
+        return ptr;
+    }
+
+    /// Returns memory of allocate_aligned, align has to be the same.
+    void deallocate_aligned(T *ptr, size_t n, size_t align) noexcept
+    {
+        if (trace_recorder *recorder = HeapHolder::heap.get_trace_recorder()) {
+            recorder->record_deallocate(ptr, byte_count(n));
+        }
+        if (is_slab_object(n, align)) {
+            HeapHolder::heap.deallocate_slot(ptr);
+            return;
+        }
+        HeapHolder::heap.deallocate(ptr, align_size_up(byte_count(n)));
+    }
+
+private:
+    T * allocate_from_heap(size_t n, size_t align)
+    {
+        if (is_slab_object(n, align)) {
+            void *slot = HeapHolder::heap.allocate_slot(byte_count(n));
+            if (!slot) {
+                throw allocator_exception{"Run out of memory"};
+            }
+            return reinterpret_cast<T *>(slot);
+        }
+
+        size_t bytes_num = byte_count(n);
+        bytes_num = align_size_up(bytes_num);
+
+        //BOOST_LOG_TRIVIAL(debug) << "Allocating " << bytes_num << " bytes.";
+
+        void *data = HeapHolder::heap.template allocate<FitPolicy>(bytes_num, std::max(align, alignment));
+        if (!data) {
+            throw allocator_exception{"Run out of memory"};
+        }
+
+        return reinterpret_cast<T *>(data);
+    }
+
+    bool resize_in_place(T *ptr, size_t n, size_t new_n)
+    {
+        // Slots of slabs have fixed size, and a block must not become one.
+        if (is_slab_object(n) || is_slab_object(new_n)) {
+            return false;
+        }
+        if (!HeapHolder::heap.resize_in_place(ptr, align_size_up(byte_count(n)), align_size_up(byte_count(new_n)))) {
+            return false;
+        }
+        if (trace_recorder *recorder = HeapHolder::heap.get_trace_recorder()) {
+            recorder->record_resize(ptr, byte_count(new_n));
+        }
+        return true;
+    }
+
+    /**
+     * Single small objects go to slabs, small arrays too with sized slots. The
+     * size part of the decision is known at compile time for single objects.
+     */
+    static bool is_slab_object(size_t n, size_t align = type_alignment)
+    {
+        // Slots are aligned to the default alignment only.
+        if (type_size > slab_pool::max_slot_size || align > alignment || !HeapHolder::heap.uses_slab_pools()) {
+            return false;
+        }
+        return n == 1 || (n <= slab_pool::max_slot_size / type_size && HeapHolder::heap.uses_sized_slots());
+    }
+
+    size_t byte_count(size_t type_count) const
+    {
+        return type_size * type_count;
+    }
+};
+
+#endif //INBLOCK_ALLOCATOR_HPP
@@ -0,0 +1,287 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <malloc.h>
+#include <new>
+#include <pthread.h>
+#include <unistd.h>
+#include "inblock_malloc.hpp"
+
+/// Stored right in front of every payload.
+struct block_header_t {
+    /// Payload size the block was allocated with from the heap.
+    size_t block_size;
+    /// Distance of the payload from the start of the block, the header is its last part.
+    size_t offset;
+};
+
+/// Alignment of malloc, enough for every fundamental type.
+static constexpr size_t malloc_alignment = alignof(std::max_align_t);
+static constexpr size_t default_heap_size_mib = 256;
+/// Blocks bigger than this are mapped on their own, they would only split the heap.
+static constexpr size_t direct_map_threshold = 1024 * 1024;
+/// Sizes over this cannot get their header and padding without overflow.
+static constexpr size_t max_request_size = SIZE_MAX / 2;
+
+static_assert(sizeof(block_header_t) == malloc_alignment, "Header must keep the payload aligned");
+
+/// Malloc cannot report a failure here, the message is written without allocating.
+[[noreturn]] static void fail(const char *message)
+{
+    ssize_t written = write(STDERR_FILENO, message, std::strlen(message));
+    static_cast<void>(written);
+    std::abort();
+}
+
+/// Nothing here may call malloc, the heap is created within the first call of it.
+static inblock_allocator_heap * create_heap()
+{
+    // Never destroyed, so blocks freed by destructors of other static objects still find it.
+    alignas(inblock_allocator_heap) static unsigned char storage[sizeof(inblock_allocator_heap)];
+    auto heap = new (storage) inblock_allocator_heap;
+
+    allocation_strategy strategy = allocation_strategy::tlsf;
+    const char *strategy_name = std::getenv("INBLOCK_MALLOC_STRATEGY");
+    if (strategy_name && std::strcmp(strategy_name, "chunk_list") == 0) {
+        strategy = allocation_strategy::chunk_list;
+    }
+    size_t heap_size_mib = default_heap_size_mib;
+    if (const char *size_value = std::getenv("INBLOCK_MALLOC_HEAP_SIZE")) {
+        heap_size_mib = std::max<size_t>(std::strtoull(size_value, nullptr, 10), 1);
+    }
+
+    size_t heap_size = heap_size_mib * 1024 * 1024;
+    void *memory = map_memory(heap_size);
+    if (!memory) {
+        fail("inblock_malloc: cannot map the heap\n");
+    }
+    heap->set_thread_safe(true);
+    heap->set_thread_caches(false);
+    heap->set_growable(true);
+    heap->set_direct_map_threshold(direct_map_threshold);
+    (*heap)(memory, heap_size, strategy);
+    return heap;
+}
+
+static block_header_t * get_header(const void *ptr)
+{
+    return reinterpret_cast<block_header_t *>(reinterpret_cast<address_t>(ptr) - sizeof(block_header_t));
+}
+
+static void * get_block(const void *ptr, const block_header_t *header)
+{
+    return reinterpret_cast<void *>(reinterpret_cast<address_t>(ptr) - header->offset);
+}
+
+static size_t get_payload_usable_size(const void *ptr)
+{
+    const block_header_t *header = get_header(ptr);
+    return get_malloc_heap().get_usable_size(get_block(ptr, header), header->block_size) - header->offset;
+}
+
+/// @param align Power of two of at least malloc_alignment.
+static void * allocate_payload(size_t size, size_t align)
+{
+    if (size > max_request_size || align > max_request_size) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    // The header fits in front of an aligned payload, alignments over max_alignment are padded by hand.
+    size_t block_size = align_size_up(size + std::max(align, sizeof(block_header_t)));
+    void *block = get_malloc_heap().allocate<next_fit>(block_size, std::min(align, max_alignment));
+    if (!block) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+
+    auto block_addr = reinterpret_cast<address_t>(block);
+    address_t payload_addr = align_addr_up(block_addr + sizeof(block_header_t), align);
+    new (reinterpret_cast<void *>(payload_addr - sizeof(block_header_t))) block_header_t{block_size,
+                                                                                       payload_addr - block_addr};
+    return reinterpret_cast<void *>(payload_addr);
+}
+
+inblock_allocator_heap & get_malloc_heap() noexcept
+{
+    static inblock_allocator_heap *heap = create_heap();
+    return *heap;
+}
+
+static void prepare_fork()
+{
+    get_malloc_heap().prepare_fork();
+}
+
+static void parent_after_fork()
+{
+    get_malloc_heap().parent_after_fork();
+}
+
+static void child_after_fork()
+{
+    get_malloc_heap().child_after_fork();
+}
+
+/**
+ * Another thread may hold the heap lock while the process forks, the child
+ * would never get it. Registered on load rather than with the heap,
+ * pthread_atfork may call malloc itself.
+ */
+[[maybe_unused]] static const int fork_handlers = pthread_atfork(prepare_fork, parent_after_fork, child_after_fork);
+
+void * inblock_malloc(size_t size) noexcept
+{
+    return allocate_payload(size, malloc_alignment);
+}
+
+void inblock_free(void *ptr) noexcept
+{
+    if (!ptr) {
+        return;
+    }
+    block_header_t *header = get_header(ptr);
+    get_malloc_heap().deallocate(get_block(ptr, header), header->block_size);
+}
+
+void * inblock_calloc(size_t count, size_t size) noexcept
+{
+    size_t total_size = 0;
+    if (__builtin_mul_overflow(count, size, &total_size)) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    void *ptr = inblock_malloc(total_size);
+    // Blocks with mappings of their own come zeroed from the system.
+    if (ptr && get_header(ptr)->block_size < get_malloc_heap().get_direct_map_threshold()) {
+        std::memset(ptr, 0, total_size);
+    }
+    return ptr;
+}
+
+void * inblock_realloc(void *ptr, size_t size) noexcept
+{
+    if (!ptr) {
+        return inblock_malloc(size);
+    }
+    if (size == 0) {
+        inblock_free(ptr);
+        return nullptr;
+    }
+
+    size_t old_size = get_payload_usable_size(ptr);
+    if (size <= max_request_size) {
+        inblock_allocator_heap &heap = get_malloc_heap();
+        block_header_t *header = get_header(ptr);
+        size_t block_size = align_size_up(header->offset + size);
+        // Shrinking by less than half keeps the block as it is.
+        if (size <= old_size && block_size > header->block_size / 2) {
+            return ptr;
+        }
+        if (heap.resize_in_place(get_block(ptr, header), header->block_size, block_size)) {
+            header->block_size = block_size;
+            return ptr;
+        }
+        if (size <= old_size) {
+            return ptr;
+        }
+    }
+
+    void *new_ptr = inblock_malloc(size);
+    if (!new_ptr) {
+        return nullptr;
+    }
+    std::memcpy(new_ptr, ptr, old_size);
+    inblock_free(ptr);
+    return new_ptr;
+}
+
+void * inblock_aligned_alloc(size_t align, size_t size) noexcept
+{
+    if (!is_power_of_two(align)) {
+        errno = EINVAL;
+        return nullptr;
+    }
+    return allocate_payload(size, std::max(align, malloc_alignment));
+}
+
+size_t inblock_malloc_usable_size(const void *ptr) noexcept
+{
+    return ptr ? get_payload_usable_size(ptr) : 0;
+}
+
+#ifdef INBLOCK_MALLOC_REPLACE_LIBC
+
+/// libc calls these by their names, so defining them replaces its allocator in the whole process.
+extern "C" {
+
+void * malloc(size_t size) noexcept
+{
+    return inblock_malloc(size);
+}
+
+void free(void *ptr) noexcept
+{
+    inblock_free(ptr);
+}
+
+void * calloc(size_t count, size_t size) noexcept
+{
+    return inblock_calloc(count, size);
+}
+
+void * realloc(void *ptr, size_t size) noexcept
+{
+    return inblock_realloc(ptr, size);
+}
+
+void * reallocarray(void *ptr, size_t count, size_t size) noexcept
+{
+    size_t total_size = 0;
+    if (__builtin_mul_overflow(count, size, &total_size)) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    return inblock_realloc(ptr, total_size);
+}
+
+void * memalign(size_t align, size_t size) noexcept
+{
+    return inblock_aligned_alloc(align, size);
+}
+
+void * aligned_alloc(size_t align, size_t size) noexcept
+{
+    return inblock_aligned_alloc(align, size);
+}
+
+int posix_memalign(void **ptr, size_t align, size_t size) noexcept
+{
+    if (!is_power_of_two(align) || align % sizeof(void *) != 0) {
+        return EINVAL;
+    }
+    void *payload = inblock_aligned_alloc(align, size);
+    if (!payload) {
+        return ENOMEM;
+    }
+    *ptr = payload;
+    return 0;
+}
+
+void * valloc(size_t size) noexcept
+{
+    return inblock_aligned_alloc(get_page_size(), size);
+}
+
+void * pvalloc(size_t size) noexcept
+{
+    return inblock_aligned_alloc(get_page_size(), align_size_up(size, get_page_size()));
+}
+
+size_t malloc_usable_size(void *ptr) noexcept
+{
+    return inblock_malloc_usable_size(ptr);
+}
+
+} // extern "C"
+#endif
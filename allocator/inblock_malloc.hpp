@@ -0,0 +1,55 @@
+#ifndef INBLOCK_MALLOC_HPP
+#define INBLOCK_MALLOC_HPP
+
+#include <cstddef>
+#include "inblock_allocator.hpp"
+
+/**
+ * malloc-like functions over one process-wide heap, so whole programs can be
+ * measured against the allocator of libc without changing their sources.
+ * Built with INBLOCK_MALLOC_REPLACE_LIBC they also stand in for malloc, free,
+ * calloc, realloc and the memalign family, the inblock_malloc library is
+ * meant for LD_PRELOAD. The inblock_new library replaces the global operator
+ * new and delete only and is linked into the program instead.
+ *
+ * The heap is thread-safe TLSF heap that grows by regions, huge blocks get
+ * mappings of their own. Every block starts with a header holding its size,
+ * free is not told the size. The heap is created on the first call and never
+ * destroyed, blocks may be freed until the very end of the process.
+ *
+ * Environment, read once when the heap is created:
+ * - INBLOCK_MALLOC_STRATEGY: tlsf (default) or chunk_list, the chunk list
+ *   heap places blocks by next fit.
+ * - INBLOCK_MALLOC_HEAP_SIZE: size of the first memory in MiB, 256 by default.
+ *
+ * Thread caches are turned off, their thread-local destructors allocate while
+ * the thread exits. The heap lock is taken around fork by pthread_atfork
+ * handlers, so a child forked by a multithreaded program may allocate.
+ */
+
+/// Payload aligned for any fundamental type, nullptr when the heap is exhausted.
+void * inblock_malloc(size_t size) noexcept;
+
+/// Takes blocks of every function here, nullptr is ignored.
+void inblock_free(void *ptr) noexcept;
+
+/// Zeroed payload for count objects, nullptr also when the size overflows.
+void * inblock_calloc(size_t count, size_t size) noexcept;
+
+/**
+ * Grows or shrinks the payload, in place when the heap has room after it.
+ * @return Payload with the old content, nullptr when it failed and ptr is
+ *         kept or when size is 0 and ptr was freed.
+ */
+void * inblock_realloc(void *ptr, size_t size) noexcept;
+
+/// @param align Power of two, it may exceed max_alignment.
+void * inblock_aligned_alloc(size_t align, size_t size) noexcept;
+
+/// Bytes of the payload that may be used, at least the requested size.
+size_t inblock_malloc_usable_size(const void *ptr) noexcept;
+
+/// Heap behind the functions, e.g. for its statistics.
+inblock_allocator_heap & get_malloc_heap() noexcept;
+
+#endif //INBLOCK_MALLOC_HPP
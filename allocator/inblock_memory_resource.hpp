@@ -0,0 +1,75 @@
+#ifndef INBLOCK_MEMORY_RESOURCE_HPP
+#define INBLOCK_MEMORY_RESOURCE_HPP
+
+#include <algorithm>
+#include <memory_resource>
+#include "inblock_allocator.hpp"
+
+/**
+ * Polymorphic memory resource drawing from a heap picked at runtime, so
+ * std::pmr containers use the heap without changing their types. Small
+ * blocks with the default alignment go to slabs when the heap has slab pools,
+ * the size and alignment passed to deallocate tell them apart. Two resources
+ * are equal when they share the heap.
+ *
+ * The resource does not own the heap, which has to outlive it and every
+ * container that uses it.
+ */
+class inblock_memory_resource : public std::pmr::memory_resource {
+public:
+    explicit inblock_memory_resource(inblock_allocator_heap &heap) noexcept
+        : heap{heap}
+    {}
+
+    inblock_allocator_heap & get_heap() const noexcept
+    {
+        return heap;
+    }
+
+protected:
+    /// @throws allocator_exception when the heap is exhausted or the alignment is over max_alignment.
+    void * do_allocate(size_t bytes, size_t align) override
+    {
+        if (!is_power_of_two(align) || align > max_alignment) {
+            throw allocator_exception{"Unsupported alignment"};
+        }
+
+        void *ptr = is_slab_block(bytes, align) ? heap.allocate_slot(bytes)
+                                                : heap.allocate(align_size_up(bytes), std::max(align, alignment));
+        if (!ptr) {
+            throw allocator_exception{"Run out of memory"};
+        }
+        if (trace_recorder *recorder = heap.get_trace_recorder()) {
+            recorder->record_allocate(ptr, bytes);
+        }
+        return ptr;
+    }
+
+    void do_deallocate(void *ptr, size_t bytes, size_t align) override
+    {
+        if (trace_recorder *recorder = heap.get_trace_recorder()) {
+            recorder->record_deallocate(ptr, bytes);
+        }
+        if (is_slab_block(bytes, align)) {
+            heap.deallocate_slot(ptr);
+            return;
+        }
+        heap.deallocate(ptr, align_size_up(bytes));
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        auto other_resource = dynamic_cast<const inblock_memory_resource *>(&other);
+        return other_resource && &other_resource->heap == &heap;
+    }
+
+private:
+    inblock_allocator_heap &heap;
+
+    bool is_slab_block(size_t bytes, size_t align) const
+    {
+        return bytes <= slab_pool::max_slot_size && align <= alignment && heap.uses_slab_pools();
+    }
+};
+
+#endif //INBLOCK_MEMORY_RESOURCE_HPP
@@ -0,0 +1,134 @@
+#include <new>
+#include "inblock_malloc.hpp"
+
+/**
+ * Global operator new and delete over the heap of inblock_malloc. Linking the
+ * inblock_new library into a program replaces them, malloc stays the one of
+ * libc. Sizes and alignments passed to delete are not needed, the block
+ * header knows them.
+ */
+
+static void * allocate_or_throw(size_t size, size_t align)
+{
+    while (true) {
+        void *ptr = align <= alignof(std::max_align_t) ? inblock_malloc(size) : inblock_aligned_alloc(align, size);
+        if (ptr) {
+            return ptr;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) {
+            throw std::bad_alloc{};
+        }
+        handler();
+    }
+}
+
+static void * allocate_or_null(size_t size, size_t align) noexcept
+{
+    try {
+        return allocate_or_throw(size, align);
+    }
+    catch (...) {
+        return nullptr;
+    }
+}
+
+void * operator new(size_t size)
+{
+    return allocate_or_throw(size, alignof(std::max_align_t));
+}
+
+void * operator new[](size_t size)
+{
+    return allocate_or_throw(size, alignof(std::max_align_t));
+}
+
+void * operator new(size_t size, std::align_val_t align)
+{
+    return allocate_or_throw(size, static_cast<size_t>(align));
+}
+
+void * operator new[](size_t size, std::align_val_t align)
+{
+    return allocate_or_throw(size, static_cast<size_t>(align));
+}
+
+void * operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    return allocate_or_null(size, alignof(std::max_align_t));
+}
+
+void * operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+    return allocate_or_null(size, alignof(std::max_align_t));
+}
+
+void * operator new(size_t size, std::align_val_t align, const std::nothrow_t &) noexcept
+{
+    return allocate_or_null(size, static_cast<size_t>(align));
+}
+
+void * operator new[](size_t size, std::align_val_t align, const std::nothrow_t &) noexcept
+{
+    return allocate_or_null(size, static_cast<size_t>(align));
+}
+
+void operator delete(void *ptr) noexcept
+{
+    inblock_free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    inblock_free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    inblock_free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+    inblock_free(ptr);
+}
+
+void operator delete(void *ptr, std::align_val_t) noexcept
+{
+    inblock_free(ptr);
+}
+
+void operator delete[](void *ptr, std::align_val_t) noexcept
+{
+    inblock_free(ptr);
+}
+
+void operator delete(void *ptr, size_t, std::align_val_t) noexcept
+{
+    inblock_free(ptr);
+}
+
+void operator delete[](void *ptr, size_t, std::align_val_t) noexcept
+{
+    inblock_free(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept
+{
+    inblock_free(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept
+{
+    inblock_free(ptr);
+}
+
+void operator delete(void *ptr, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    inblock_free(ptr);
+}
+
+void operator delete[](void *ptr, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    inblock_free(ptr);
+}
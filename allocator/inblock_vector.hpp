@@ -0,0 +1,298 @@
+#ifndef INBLOCK_VECTOR_HPP
+#define INBLOCK_VECTOR_HPP
+
+#include <cstddef>
+#include <initializer_list>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "inblock_allocator.hpp"
+
+/**
+ * Vector that grows its buffer in place whenever the heap has free space right
+ * after it, so elements are moved only when the buffer really has to be
+ * relocated. Capacity is taken from allocate_at_least, so the slack the heap
+ * hands out anyway is used as well.
+ */
+template<typename T, typename HeapHolder, typename FitPolicy = first_fit>
+class inblock_vector {
+public:
+    using value_type = T;
+    using allocator_type = inblock_allocator<T, HeapHolder, FitPolicy>;
+    using size_type = size_t;
+    using iterator = T *;
+    using const_iterator = const T *;
+
+    inblock_vector() noexcept = default;
+
+    inblock_vector(std::initializer_list<T> values)
+    {
+        reserve(values.size());
+        for (const T &value : values) {
+            push_back(value);
+        }
+    }
+
+    inblock_vector(const inblock_vector &other)
+    {
+        reserve(other.size());
+        for (const T &value : other) {
+            push_back(value);
+        }
+    }
+
+    inblock_vector(inblock_vector &&other) noexcept
+        : elements{std::exchange(other.elements, nullptr)},
+          elements_count{std::exchange(other.elements_count, 0)},
+          elements_capacity{std::exchange(other.elements_capacity, 0)}
+    {}
+
+    inblock_vector & operator=(inblock_vector other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+
+    ~inblock_vector()
+    {
+        clear();
+        release();
+    }
+
+    void swap(inblock_vector &other) noexcept
+    {
+        std::swap(elements, other.elements);
+        std::swap(elements_count, other.elements_count);
+        std::swap(elements_capacity, other.elements_capacity);
+    }
+
+    void push_back(const T &value)
+    {
+        emplace_back(value);
+    }
+
+    void push_back(T &&value)
+    {
+        emplace_back(std::move(value));
+    }
+
+    template<typename... Args>
+    T & emplace_back(Args &&... args)
+    {
+        if (elements_count == elements_capacity) {
+            size_t new_capacity = elements_capacity == 0 ? 1 : 2 * elements_capacity;
+            if (!try_grow_in_place(new_capacity)) {
+                return relocate_and_emplace_back(new_capacity, std::forward<Args>(args)...);
+            }
+        }
+        T *element = new (elements + elements_count) T(std::forward<Args>(args)...);
+        elements_count++;
+        return *element;
+    }
+
+    void pop_back()
+    {
+        assert(elements_count > 0);
+        elements_count--;
+        elements[elements_count].~T();
+    }
+
+    void resize(size_t count)
+    {
+        reserve(count);
+        while (elements_count < count) {
+            emplace_back();
+        }
+        while (elements_count > count) {
+            pop_back();
+        }
+    }
+
+    void reserve(size_t count)
+    {
+        if (count > elements_capacity) {
+            grow(count);
+        }
+    }
+
+    /// Gives unused capacity back to the heap if the buffer can shrink in place.
+    void shrink_to_fit()
+    {
+        if (elements_count == elements_capacity) {
+            return;
+        }
+        if (elements_count == 0) {
+            release();
+            return;
+        }
+        if (allocator.try_shrink(elements, elements_capacity, elements_count)) {
+            elements_capacity = elements_count;
+        }
+    }
+
+    void clear() noexcept
+    {
+        while (elements_count > 0) {
+            pop_back();
+        }
+    }
+
+    T & operator[](size_t index)
+    {
+        return elements[index];
+    }
+
+    const T & operator[](size_t index) const
+    {
+        return elements[index];
+    }
+
+    T & back()
+    {
+        return elements[elements_count - 1];
+    }
+
+    T * data() noexcept
+    {
+        return elements;
+    }
+
+    const T * data() const noexcept
+    {
+        return elements;
+    }
+
+    size_t size() const noexcept
+    {
+        return elements_count;
+    }
+
+    size_t capacity() const noexcept
+    {
+        return elements_capacity;
+    }
+
+    bool empty() const noexcept
+    {
+        return elements_count == 0;
+    }
+
+    iterator begin() noexcept
+    {
+        return elements;
+    }
+
+    iterator end() noexcept
+    {
+        return elements + elements_count;
+    }
+
+    const_iterator begin() const noexcept
+    {
+        return elements;
+    }
+
+    const_iterator end() const noexcept
+    {
+        return elements + elements_count;
+    }
+
+private:
+    allocator_type allocator;
+    T *elements = nullptr;
+    size_t elements_count = 0;
+    size_t elements_capacity = 0;
+
+    /// Frees a freshly allocated buffer unless it was handed over to the vector.
+    struct buffer_guard {
+        allocator_type &allocator;
+        T *buffer;
+        size_t capacity;
+
+        ~buffer_guard()
+        {
+            if (buffer) {
+                allocator.deallocate(buffer, capacity);
+            }
+        }
+    };
+
+    bool try_grow_in_place(size_t new_capacity)
+    {
+        if (elements && allocator.try_expand(elements, elements_capacity, new_capacity)) {
+            elements_capacity = new_capacity;
+            return true;
+        }
+        return false;
+    }
+
+    void grow(size_t new_capacity)
+    {
+        if (try_grow_in_place(new_capacity)) {
+            return;
+        }
+
+        auto [new_elements, real_capacity] = allocator.allocate_at_least(new_capacity);
+        buffer_guard guard{allocator, new_elements, real_capacity};
+        move_elements_to(new_elements);
+        guard.buffer = nullptr;
+        adopt(new_elements, real_capacity);
+    }
+
+    /**
+     * Builds the new element in the new buffer before the old elements are
+     * touched, so arguments referring into the vector are still alive.
+     */
+    template<typename... Args>
+    T & relocate_and_emplace_back(size_t new_capacity, Args &&... args)
+    {
+        auto [new_elements, real_capacity] = allocator.allocate_at_least(new_capacity);
+        buffer_guard guard{allocator, new_elements, real_capacity};
+        T *element = new (new_elements + elements_count) T(std::forward<Args>(args)...);
+        try {
+            move_elements_to(new_elements);
+        }
+        catch (...) {
+            element->~T();
+            throw;
+        }
+        guard.buffer = nullptr;
+        adopt(new_elements, real_capacity);
+        elements_count++;
+        return *element;
+    }
+
+    /// Moves (or copies, if moving may throw) all elements; on a throw the copies made so far are destroyed.
+    void move_elements_to(T *new_elements)
+    {
+        if constexpr (std::is_nothrow_move_constructible_v<T> || !std::is_copy_constructible_v<T>) {
+            std::uninitialized_move(elements, elements + elements_count, new_elements);
+        }
+        else {
+            std::uninitialized_copy(elements, elements + elements_count, new_elements);
+        }
+    }
+
+    /// Destroys the old elements and switches to a buffer already holding their moved copies.
+    void adopt(T *new_elements, size_t new_capacity) noexcept
+    {
+        std::destroy(elements, elements + elements_count);
+        size_t count = elements_count;
+        release();
+        elements = new_elements;
+        elements_count = count;
+        elements_capacity = new_capacity;
+    }
+
+    void release() noexcept
+    {
+        if (elements) {
+            allocator.deallocate(elements, elements_capacity);
+        }
+        elements = nullptr;
+        elements_capacity = 0;
+    }
+};
+
+#endif //INBLOCK_VECTOR_HPP
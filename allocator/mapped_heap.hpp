@@ -0,0 +1,175 @@
+#ifndef MAPPED_HEAP_HPP
+#define MAPPED_HEAP_HPP
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "inblock_allocator.hpp"
+
+/// Start of the superblock of every mapped heap, the heap follows at heap_offset.
+struct mapped_heap_header_t {
+    /// Written last when the heap is created, so nobody sees the heap before it is ready.
+    std::atomic<uint64_t> magic;
+    uint64_t heap_offset;
+    uint64_t heap_size;
+    /// Offset of the root object from the heap start, 0 if there is none.
+    std::atomic<uint64_t> root_offset;
+};
+
+/**
+ * Chunk list heap in a file mapped shared, the common part of heap_file and
+ * shared_heap. The superblock is in the first page of the file and starts
+ * with mapped_heap_header_t, the heap takes the rest of the file.
+ *
+ * The file may be mapped at a different address by every process and every
+ * time it is mapped. Chunks store sizes only, objects in the heap refer to
+ * each other by offsets, see get_offset and get_pointer. Data structures are
+ * found through the root object.
+ */
+class mapped_heap {
+public:
+    mapped_heap(const mapped_heap &) = delete;
+    mapped_heap & operator=(const mapped_heap &) = delete;
+
+    /// Offset of an object in the heap, the same in every mapping of the file.
+    uint64_t get_offset(const void *ptr) const
+    {
+        if (!ptr) {
+            return 0;
+        }
+        return reinterpret_cast<address_t>(ptr) - reinterpret_cast<address_t>(get_heap_memory());
+    }
+
+    /// @param offset Result of get_offset, 0 gives nullptr.
+    template<typename T>
+    T * get_pointer(uint64_t offset) const
+    {
+        if (offset == 0) {
+            return nullptr;
+        }
+        return reinterpret_cast<T *>(reinterpret_cast<address_t>(get_heap_memory()) + offset);
+    }
+
+    template<typename T>
+    T * get_root() const
+    {
+        return get_pointer<T>(get_header()->root_offset.load(std::memory_order_acquire));
+    }
+
+    /// Publishes the object to other mappings, it has to be fully built before.
+    void set_root(const void *ptr)
+    {
+        get_header()->root_offset.store(get_offset(ptr), std::memory_order_release);
+    }
+
+protected:
+    int fd = -1;
+    void *mapping = nullptr;
+    size_t map_size = 0;
+
+    mapped_heap() = default;
+
+    ~mapped_heap()
+    {
+        unmap();
+    }
+
+    /**
+     * @param description Names the file open in fd in error messages.
+     * @throws allocator_exception if the size cannot be read.
+     */
+    size_t get_file_size(const std::string &description) const
+    {
+        struct stat file_stat{};
+        if (fstat(fd, &file_stat) != 0) {
+            throw allocator_exception{"Cannot stat " + description + ": " + std::strerror(errno)};
+        }
+        return static_cast<size_t>(file_stat.st_size);
+    }
+
+    /**
+     * Maps the whole file open in fd.
+     * @param new_map_size Size an empty file is resized to, 0 keeps the size of the file.
+     * @param description Names the file in error messages.
+     */
+    void map_file(const std::string &description, size_t new_map_size)
+    {
+        if (new_map_size != 0) {
+            if (ftruncate(fd, static_cast<off_t>(new_map_size)) != 0) {
+                throw allocator_exception{"Cannot resize " + description + ": " + std::strerror(errno)};
+            }
+            map_size = new_map_size;
+        }
+        else {
+            map_size = get_file_size(description);
+        }
+
+        void *ptr = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (ptr == MAP_FAILED) {
+            throw allocator_exception{"Cannot map " + description + ": " + std::strerror(errno)};
+        }
+        mapping = ptr;
+    }
+
+    /// Size of a new file holding the superblock page and a heap of given size.
+    static size_t get_map_size(size_t heap_size)
+    {
+        return get_page_size() + align_size_up(heap_size, get_page_size());
+    }
+
+    /// Places the heap of a new file right after the superblock page, publish makes it visible.
+    void lay_out_heap()
+    {
+        mapped_heap_header_t *header = get_header();
+        header->heap_offset = get_page_size();
+        header->heap_size = map_size - get_page_size();
+        header->root_offset.store(0, std::memory_order_relaxed);
+    }
+
+    void publish(uint64_t magic)
+    {
+        get_header()->magic.store(magic, std::memory_order_release);
+    }
+
+    /// Whether the file holds a heap published with given magic that spans the rest of the file.
+    bool holds_heap(uint64_t magic, size_t superblock_size) const
+    {
+        const mapped_heap_header_t *header = get_header();
+        return map_size >= superblock_size && header->magic.load(std::memory_order_acquire) == magic &&
+               header->heap_offset + header->heap_size == map_size;
+    }
+
+    mapped_heap_header_t * get_header() const
+    {
+        return static_cast<mapped_heap_header_t *>(mapping);
+    }
+
+    void * get_heap_memory() const
+    {
+        return reinterpret_cast<void *>(reinterpret_cast<address_t>(mapping) + get_header()->heap_offset);
+    }
+
+    size_t get_heap_size() const
+    {
+        return get_header()->heap_size;
+    }
+
+    void unmap() noexcept
+    {
+        if (mapping) {
+            munmap(mapping, map_size);
+            mapping = nullptr;
+        }
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+};
+
+#endif //MAPPED_HEAP_HPP
@@ -0,0 +1,216 @@
+#ifndef OS_MEMORY_HPP
+#define OS_MEMORY_HPP
+
+#include <fstream>
+#include <limits>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "common.hpp"
+#include "allocator_exception.hpp"
+
+/// Thin wrappers over the memory mapping calls of the operating system.
+
+inline size_t get_page_size()
+{
+    static const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return page_size;
+}
+
+/**
+ * Maps private anonymous memory. Pages are zeroed and backed lazily, on the
+ * first touch.
+ * @return nullptr when the mapping failed.
+ */
+inline void * map_memory(size_t n_bytes)
+{
+    void *ptr = mmap(nullptr, n_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return ptr == MAP_FAILED ? nullptr : ptr;
+}
+
+inline void unmap_memory(void *ptr, size_t n_bytes) noexcept
+{
+    munmap(ptr, n_bytes);
+}
+
+/**
+ * Gives the pages lying wholly inside [begin, end) back to the system, the
+ * range stays mapped and reads as zeros or as its old content afterwards.
+ * @param lazy Uses MADV_FREE where available, the pages are reclaimed only
+ *        under memory pressure, which is cheaper than dropping them at once.
+ * @return Number of bytes released.
+ */
+inline size_t purge_memory(address_t begin, address_t end, bool lazy) noexcept
+{
+    address_t first_page = align_addr_up(begin, get_page_size());
+    address_t end_page = align_addr_down(end, get_page_size());
+    if (first_page >= end_page) {
+        return 0;
+    }
+
+    int advice = MADV_DONTNEED;
+#ifdef MADV_FREE
+    if (lazy) {
+        advice = MADV_FREE;
+    }
+#endif
+    if (madvise(reinterpret_cast<void *>(first_page), end_page - first_page, advice) != 0) {
+        return 0;
+    }
+    return end_page - first_page;
+}
+
+/// Resident set size of the whole process, 0 when it cannot be read.
+inline size_t get_resident_size()
+{
+    std::ifstream statm{"/proc/self/statm"};
+    size_t total_pages = 0;
+    size_t resident_pages = 0;
+    if (!(statm >> total_pages >> resident_pages)) {
+        return 0;
+    }
+    return resident_pages * get_page_size();
+}
+
+/// Highest resident set size of the process since it started or since reset_peak_resident_size, 0 when it cannot be read.
+inline size_t get_peak_resident_size()
+{
+    std::ifstream status{"/proc/self/status"};
+    std::string key;
+    while (status >> key) {
+        if (key == "VmHWM:") {
+            size_t peak_kib = 0;
+            status >> peak_kib;
+            return peak_kib * 1024;
+        }
+        status.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    }
+    return 0;
+}
+
+/// Lowers the peak resident set size to the current one, false when the system does not support it.
+inline bool reset_peak_resident_size()
+{
+    std::ofstream clear_refs{"/proc/self/clear_refs"};
+    return static_cast<bool>(clear_refs << "5" << std::flush);
+}
+
+constexpr size_t huge_page_size = 2 * 1024 * 1024;
+
+/// Kind of pages backing a mapped_region.
+enum class page_backing {
+    /// Base pages of the system.
+    base,
+    /// Base pages advised to be merged into transparent huge pages, the kernel may not follow.
+    transparent_huge,
+    /// Huge pages reserved by the system administrator in the hugetlb pool.
+    hugetlb
+};
+
+struct mapping_options_t {
+    /// Tries hugetlb pages, then transparent huge pages, then falls back to base pages.
+    bool huge_pages = false;
+    /// Faults all pages in up front, so the first touch does not stall the user of the memory.
+    bool prefault = false;
+};
+
+/**
+ * Anonymous memory mapped to back a heap, unmapped again when destroyed. With
+ * huge pages the mapping starts at a huge page boundary and its size is
+ * rounded up to whole huge pages, so fewer TLB entries cover the heap.
+ */
+class mapped_region {
+public:
+    explicit mapped_region(size_t n_bytes, const mapping_options_t &options = {})
+    {
+        if (options.huge_pages) {
+            map_huge_pages(n_bytes);
+        }
+        if (!data) {
+            size = align_size_up(n_bytes, get_page_size());
+            data = map_memory(size);
+            backing = page_backing::base;
+        }
+        if (!data) {
+            throw allocator_exception{"Cannot map memory."};
+        }
+        if (options.prefault) {
+            prefault();
+        }
+    }
+
+    ~mapped_region()
+    {
+        unmap_memory(data, size);
+    }
+
+    mapped_region(const mapped_region &) = delete;
+    mapped_region & operator=(const mapped_region &) = delete;
+
+    void * get_data() const
+    {
+        return data;
+    }
+
+    size_t get_size() const
+    {
+        return size;
+    }
+
+    page_backing get_backing() const
+    {
+        return backing;
+    }
+
+private:
+    void *data = nullptr;
+    size_t size = 0;
+    page_backing backing = page_backing::base;
+
+    void map_huge_pages(size_t n_bytes)
+    {
+        size = align_size_up(n_bytes, huge_page_size);
+#ifdef MAP_HUGETLB
+        void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (ptr != MAP_FAILED) {
+            data = ptr;
+            backing = page_backing::hugetlb;
+            return;
+        }
+#endif
+#ifdef MADV_HUGEPAGE
+        // One extra huge page, so that an aligned start can be cut out of the mapping.
+        size_t map_size = size + huge_page_size;
+        void *mapping = map_memory(map_size);
+        if (!mapping) {
+            return;
+        }
+        auto mapping_addr = reinterpret_cast<address_t>(mapping);
+        address_t data_addr = align_addr_up(mapping_addr, huge_page_size);
+        if (data_addr != mapping_addr) {
+            unmap_memory(mapping, data_addr - mapping_addr);
+        }
+        if (mapping_addr + map_size != data_addr + size) {
+            unmap_memory(reinterpret_cast<void *>(data_addr + size), mapping_addr + map_size - data_addr - size);
+        }
+        data = reinterpret_cast<void *>(data_addr);
+        backing = madvise(data, size, MADV_HUGEPAGE) == 0 ? page_backing::transparent_huge : page_backing::base;
+#endif
+    }
+
+    void prefault()
+    {
+#ifdef MADV_POPULATE_WRITE
+        if (madvise(data, size, MADV_POPULATE_WRITE) == 0) {
+            return;
+        }
+#endif
+        // Reads would map the shared zero page only, every page has to be written.
+        auto data_addr = reinterpret_cast<address_t>(data);
+        for (address_t addr = data_addr; addr < data_addr + size; addr += get_page_size()) {
+            *reinterpret_cast<volatile uint8_t *>(addr) = 0;
+        }
+    }
+};
+
+#endif //OS_MEMORY_HPP
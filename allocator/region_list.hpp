@@ -0,0 +1,203 @@
+#ifndef REGION_LIST_HPP
+#define REGION_LIST_HPP
+
+#include <algorithm>
+#include <new>
+#include "common.hpp"
+#include "os_memory.hpp"
+#include "tlsf.hpp"
+
+/**
+ * Regions mapped by a growable heap once its own memory is exhausted. Every
+ * region is a separate TLSF pool with a small header in front of it. A new
+ * region is at least twice as big as the previous one, so a growing heap
+ * ends up with a logarithmic number of regions.
+ *
+ * A region that becomes empty is unmapped right away unless it is the newest
+ * one, which is kept so that a heap oscillating around its limit does not
+ * map and unmap on every allocation. release_empty unmaps that one too.
+ */
+class region_list {
+public:
+    /// Size of the first region mapped, later regions grow geometrically.
+    static constexpr size_t min_region_size = 1024 * 1024;
+
+    region_list() = default;
+
+    ~region_list()
+    {
+        release_all();
+    }
+
+    region_list(const region_list &) = delete;
+    region_list & operator=(const region_list &) = delete;
+
+    /// @return nullptr when no region has space and a new one cannot be mapped.
+    void * allocate(size_t payload_size, size_t payload_alignment)
+    {
+        for (region_t *region = head; region; region = region->next) {
+            if (void *ptr = allocate_from(region, payload_size, payload_alignment)) {
+                return ptr;
+            }
+        }
+
+        region_t *region = map_region(payload_size, payload_alignment);
+        if (!region) {
+            return nullptr;
+        }
+        return allocate_from(region, payload_size, payload_alignment);
+    }
+
+    void deallocate(void *ptr) noexcept
+    {
+        region_t **link = find_link(ptr);
+        region_t *region = *link;
+        region->pool.deallocate(ptr);
+        region->live_blocks--;
+
+        if (region->live_blocks == 0 && region != head) {
+            *link = region->next;
+            unmap_region(region);
+        }
+    }
+
+    /// See tlsf_pool::resize_in_place.
+    bool resize_in_place(void *ptr, size_t payload_size)
+    {
+        return (*find_link(ptr))->pool.resize_in_place(ptr, payload_size);
+    }
+
+    /**
+     * Unmaps all regions without live blocks.
+     * @return Number of bytes unmapped.
+     */
+    size_t release_empty() noexcept
+    {
+        size_t released = 0;
+        region_t **link = &head;
+        while (*link) {
+            region_t *region = *link;
+            if (region->live_blocks == 0) {
+                *link = region->next;
+                released += region->map_size;
+                unmap_region(region);
+            }
+            else {
+                link = &region->next;
+            }
+        }
+        return released;
+    }
+
+    /// Unmaps every region, blocks allocated from them are lost.
+    void release_all() noexcept
+    {
+        while (head) {
+            region_t *region = head;
+            head = region->next;
+            unmap_region(region);
+        }
+        next_region_size = min_region_size;
+    }
+
+    size_t get_count() const
+    {
+        return count;
+    }
+
+    size_t get_mapped_size() const
+    {
+        return mapped_size;
+    }
+
+    /**
+     * Visits every block of every region, newest region first.
+     * @param func Called as func(payload_ptr, payload_size, used).
+     */
+    template <typename Func>
+    void for_each_block(Func func) const
+    {
+        for (const region_t *region = head; region; region = region->next) {
+            region->pool.for_each_block(func);
+        }
+    }
+
+    bool check() const
+    {
+        for (const region_t *region = head; region; region = region->next) {
+            if (!region->pool.check()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    /// Placed at the start of the mapping, the pool manages the rest of it.
+    struct region_t {
+        region_t *next;
+        size_t map_size;
+        size_t live_blocks;
+        tlsf_pool pool;
+    };
+
+    /// Newest region, the biggest one.
+    region_t *head = nullptr;
+    size_t count = 0;
+    size_t mapped_size = 0;
+    size_t next_region_size = min_region_size;
+
+    static void * allocate_from(region_t *region, size_t payload_size, size_t payload_alignment)
+    {
+        void *ptr = region->pool.allocate(payload_size, payload_alignment);
+        if (ptr) {
+            region->live_blocks++;
+        }
+        return ptr;
+    }
+
+    region_t * map_region(size_t payload_size, size_t payload_alignment)
+    {
+        // Segregated lists round the request up by less than 1/32 of its size.
+        size_t needed = align_size_up(sizeof(region_t)) + tlsf_pool::get_pool_overhead() + payload_size +
+                        payload_alignment + payload_size / 16;
+        size_t map_size = align_size_up(std::max(needed, next_region_size), get_page_size());
+        void *mapping = map_memory(map_size);
+        if (!mapping) {
+            return nullptr;
+        }
+
+        auto region = new (mapping) region_t{head, map_size, 0, tlsf_pool{}};
+        auto region_addr = reinterpret_cast<address_t>(mapping);
+        region->pool.initialize(align_size_up(region_addr + sizeof(region_t)), region_addr + map_size);
+        head = region;
+        count++;
+        mapped_size += map_size;
+        next_region_size = 2 * map_size;
+        return region;
+    }
+
+    void unmap_region(region_t *region) noexcept
+    {
+        count--;
+        mapped_size -= region->map_size;
+        unmap_memory(region, region->map_size);
+    }
+
+    /// Link pointing to the region that contains given block.
+    region_t ** find_link(const void *ptr)
+    {
+        auto addr = reinterpret_cast<address_t>(ptr);
+        region_t **link = &head;
+        while (true) {
+            auto region_addr = reinterpret_cast<address_t>(*link);
+            if (region_addr < addr && addr < region_addr + (*link)->map_size) {
+                return link;
+            }
+            link = &(*link)->next;
+            assert(*link);
+        }
+    }
+};
+
+#endif //REGION_LIST_HPP
@@ -0,0 +1,137 @@
+#ifndef SHARED_HEAP_HPP
+#define SHARED_HEAP_HPP
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "mapped_heap.hpp"
+
+/// Stored at the start of a shared memory segment, the heap follows at heap_offset.
+struct shared_heap_superblock_t {
+    mapped_heap_header_t header;
+    pthread_mutex_t mutex;
+    /// Offset of the chunk where next_fit resumes, shared so merges in any process keep it on a header.
+    uint64_t rover_offset;
+};
+
+/// "IBSHEAP1" read as little-endian number.
+constexpr uint64_t shared_heap_magic = 0x3150414548534249;
+
+/**
+ * Chunk list heap in a POSIX shared memory segment, so processes exchange
+ * data built by inblock_allocator without copying it. One process creates the
+ * segment, the others open it by name, each with a heap of its own that
+ * manages the same memory.
+ *
+ * Every process may map the segment elsewhere, see mapped_heap. The root
+ * object is where the other processes start. All processes lock the heap
+ * with one robust process-shared mutex stored in the segment, thread caches,
+ * slab pools, growing, direct mappings and the gap bitmap are turned off as
+ * their state would be private to one process. The next_fit rover lives in
+ * the segment too.
+ *
+ * The heap must not be used after the shared_heap is destroyed. The segment
+ * lives until remove is called and the last process unmaps it.
+ */
+class shared_heap : public mapped_heap {
+public:
+    /// Creates the segment, fails if a segment of the name exists.
+    shared_heap(inblock_allocator_heap &heap, const std::string &name, size_t heap_size)
+        : heap{heap}
+    {
+        try {
+            open_segment(name, O_CREAT | O_EXCL);
+            segment_created = true;
+            map_file("shared memory " + name, get_map_size(heap_size));
+            initialize_shared_mutex(&get_superblock()->mutex);
+            get_superblock()->rover_offset = 0;
+            lay_out_heap();
+            heap(get_heap_memory(), get_heap_size(), allocation_strategy::chunk_list);
+            share_heap();
+            publish(shared_heap_magic);
+        }
+        catch (...) {
+            unshare_heap();
+            if (segment_created) {
+                remove(name);
+            }
+            throw;
+        }
+    }
+
+    /// Opens the segment created by another process.
+    shared_heap(inblock_allocator_heap &heap, const std::string &name)
+        : heap{heap}
+    {
+        try {
+            open_segment(name, 0);
+            map_file("shared memory " + name, 0);
+            if (!holds_heap(shared_heap_magic, sizeof(shared_heap_superblock_t))) {
+                throw allocator_exception{"Shared memory " + name + " holds no heap"};
+            }
+            share_heap();
+            // Other processes may be allocating meanwhile.
+            heap_mutex lock;
+            lock.set_shared(&get_superblock()->mutex);
+            std::lock_guard<heap_mutex> guard{lock};
+            heap.attach(get_heap_memory(), get_heap_size());
+        }
+        catch (...) {
+            unshare_heap();
+            throw;
+        }
+    }
+
+    ~shared_heap()
+    {
+        unshare_heap();
+    }
+
+    /// Removes the name of the segment, the memory is freed once every process unmapped it.
+    static void remove(const std::string &name)
+    {
+        shm_unlink(name.c_str());
+    }
+
+private:
+    inblock_allocator_heap &heap;
+    bool segment_created = false;
+
+    void open_segment(const std::string &name, int flags)
+    {
+        fd = shm_open(name.c_str(), O_RDWR | flags, 0600);
+        if (fd < 0) {
+            throw allocator_exception{"Cannot open shared memory " + name + ": " + std::strerror(errno)};
+        }
+    }
+
+    shared_heap_superblock_t * get_superblock() const
+    {
+        return static_cast<shared_heap_superblock_t *>(mapping);
+    }
+
+    void share_heap()
+    {
+        heap.set_thread_safe(true);
+        heap.set_thread_caches(false);
+        heap.set_slab_pools(false);
+        heap.set_growable(false);
+        heap.set_direct_map_threshold(0);
+        heap.set_gap_bitmap(false);
+        heap.set_shared_mutex(&get_superblock()->mutex);
+        heap.set_shared_rover(&get_superblock()->rover_offset);
+    }
+
+    /// The segment is unmapped by mapped_heap afterwards.
+    void unshare_heap() noexcept
+    {
+        heap.set_shared_mutex(nullptr);
+        heap.set_shared_rover(nullptr);
+    }
+};
+
+#endif //SHARED_HEAP_HPP
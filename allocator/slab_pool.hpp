@@ -0,0 +1,170 @@
+#ifndef SLAB_POOL_HPP
+#define SLAB_POOL_HPP
+
+#include <cstdint>
+#include "common.hpp"
+
+/**
+ * Fixed-size slots for small single objects, and for small arrays when the
+ * heap trusts the size they are freed with. A slab is one block of the heap
+ * aligned to its own size and cut into slots of one size class. The slab of a
+ * slot is found by masking the slot address, so slots carry no header at all.
+ *
+ * Slabs that have a free slot are kept in a list per size class. A slab that
+ * becomes empty is handed back to the heap unless it is the last one of its
+ * class.
+ */
+class slab_pool {
+public:
+    static constexpr size_t slab_size = 4096;
+    /// Slab block stops short of the next slab boundary to leave room for the header of the following block.
+    static constexpr size_t slab_block_size = slab_size - 8 * alignment;
+    static constexpr size_t size_class_count = 16;
+    static constexpr size_t max_slot_size = size_class_count * alignment;
+
+    static size_t get_size_class(size_t payload_size)
+    {
+        assert(payload_size <= max_slot_size);
+        return payload_size == 0 ? 0 : (payload_size - 1) / alignment;
+    }
+
+    static size_t get_slot_size(size_t size_class)
+    {
+        return (size_class + 1) * alignment;
+    }
+
+    /// @return nullptr when the class has no slab with free slot, see add_slab.
+    void * allocate(size_t size_class)
+    {
+        slab_t *slab = partial_slabs[size_class];
+        if (!slab) {
+            return nullptr;
+        }
+
+        void *slot = nullptr;
+        if (slab->free_slots) {
+            slot = slab->free_slots;
+            slab->free_slots = slab->free_slots->next;
+        }
+        else {
+            assert(slab->bump_index < slab->capacity);
+            slot = get_slot(slab, slab->bump_index++);
+        }
+
+        slab->used_count++;
+        if (slab->used_count == slab->capacity) {
+            unlink(slab);
+        }
+        return slot;
+    }
+
+    /**
+     * Returns slot into its slab.
+     * @return Memory of the slab if it became empty and should be given back to the heap.
+     */
+    void * deallocate(void *slot)
+    {
+        slab_t *slab = get_slab(slot);
+        if (slab->used_count == slab->capacity) {
+            link(slab);
+        }
+
+        auto free_slot = static_cast<free_slot_t *>(slot);
+        free_slot->next = slab->free_slots;
+        slab->free_slots = free_slot;
+        slab->used_count--;
+
+        if (slab->used_count == 0 && (slab->next || slab->prev)) {
+            unlink(slab);
+            return slab;
+        }
+        return nullptr;
+    }
+
+    /// Formats memory obtained from the heap into an empty slab of given class.
+    void add_slab(void *memory, size_t size_class)
+    {
+        assert(is_slab_aligned(reinterpret_cast<address_t>(memory)));
+
+        auto slab = static_cast<slab_t *>(memory);
+        slab->next = nullptr;
+        slab->prev = nullptr;
+        slab->free_slots = nullptr;
+        slab->slot_size = static_cast<uint32_t>(get_slot_size(size_class));
+        slab->used_count = 0;
+        slab->capacity = static_cast<uint32_t>((slab_block_size - slots_offset) / slab->slot_size);
+        slab->bump_index = 0;
+        link(slab);
+    }
+
+    /// Forgets all slabs, used when the heap is re-initialized.
+    void reset()
+    {
+        for (size_t i = 0; i < size_class_count; ++i) {
+            partial_slabs[i] = nullptr;
+        }
+    }
+
+private:
+    struct free_slot_t {
+        free_slot_t *next;
+    };
+
+    struct slab_t {
+        slab_t *next;
+        slab_t *prev;
+        free_slot_t *free_slots;
+        uint32_t slot_size;
+        uint32_t used_count;
+        uint32_t capacity;
+        /// Slots from this index on were never handed out.
+        uint32_t bump_index;
+    };
+
+    static constexpr size_t slots_offset = align_size_up(sizeof(slab_t));
+
+    slab_t *partial_slabs[size_class_count] = {};
+
+    static bool is_slab_aligned(address_t addr)
+    {
+        return addr % slab_size == 0;
+    }
+
+    static slab_t * get_slab(void *slot)
+    {
+        return reinterpret_cast<slab_t *>(reinterpret_cast<address_t>(slot) & ~static_cast<address_t>(slab_size - 1));
+    }
+
+    static void * get_slot(slab_t *slab, size_t index)
+    {
+        return reinterpret_cast<void *>(reinterpret_cast<address_t>(slab) + slots_offset + index * slab->slot_size);
+    }
+
+    void link(slab_t *slab)
+    {
+        slab_t *&head = partial_slabs[get_size_class(slab->slot_size)];
+        slab->prev = nullptr;
+        slab->next = head;
+        if (head) {
+            head->prev = slab;
+        }
+        head = slab;
+    }
+
+    void unlink(slab_t *slab)
+    {
+        if (slab->prev) {
+            slab->prev->next = slab->next;
+        }
+        else {
+            partial_slabs[get_size_class(slab->slot_size)] = slab->next;
+        }
+        if (slab->next) {
+            slab->next->prev = slab->prev;
+        }
+        slab->next = nullptr;
+        slab->prev = nullptr;
+    }
+};
+
+#endif //SLAB_POOL_HPP
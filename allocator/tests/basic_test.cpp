@@ -93,6 +93,13 @@ int main ()
     std::cout << "Times for my allocator:" << std::endl;
     std::cout << "\tWall Time = " << my_wall_time << std::endl;
 
+#ifndef USE_STD_ALLOCATOR
+    // Separate run, so the counters do not influence the time.
+    holder::heap.set_stats_enabled(true);
+    run_myallocator();
+    std::cout << "\tPeak footprint = " << holder::heap.get_stats().counters.high_water_mark << " B" << std::endl;
+#endif
+
     // ==========
     double std_wall_time = measure(run_stdallocator);
 
@@ -0,0 +1,262 @@
+#include <atomic>
+#include <malloc.h>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "benchmark.hpp"
+#include "../inblock_allocator.hpp"
+#include "../inblock_memory_resource.hpp"
+
+/**
+ * Canonical allocator workloads, each run with chunk list heap under first,
+ * next and best fit, with chunk list heap indexed by gap bitmap, with chunk
+ * list heap behind std::pmr, with chunk list heap keeping small arrays in
+ * sized slots, with TLSF heap and with std::allocator. After the runs the
+ * heap purges its free gaps and glibc trims its arenas, the table shows the
+ * resident size before and after. The heap memory is mapped lazily and
+ * purged before std runs, so their resident size does not include it.
+ *
+ * Usage: bench_suite [--json] [--runs N] [--filter substring]
+ */
+
+struct holder {
+    static inblock_allocator_heap heap;
+};
+
+inblock_allocator_heap holder::heap;
+
+template<typename T>
+using heap_allocator = inblock_allocator<T, holder>;
+
+template<typename T>
+using next_fit_allocator = inblock_allocator<T, holder, next_fit>;
+
+template<typename T>
+using best_fit_allocator = inblock_allocator<T, holder, best_fit>;
+
+/// Draws from the default resource, which is set to the heap for pmr runs.
+template<typename T>
+using pmr_allocator = std::pmr::polymorphic_allocator<T>;
+
+static inblock_memory_resource heap_resource{holder::heap};
+
+const size_t mem_size = 64 * 1024 * 1024;
+// Has to outlive thread caches of all threads.
+static mapped_region mem{mem_size};
+
+/// Fills a vector by push_back, like basic_test.
+template<template<typename> class Alloc>
+struct push_back_growth {
+    static void run(latency_sampler &sample)
+    {
+        constexpr size_t push_backs = 100000;
+        std::vector<int, Alloc<int>> v;
+        for (size_t i = 0; i < push_backs; ++i) {
+            sample([&]() {
+                v.push_back(static_cast<int>(i));
+            });
+        }
+    }
+};
+
+/// Copies rows into temporaries and drops them again, like matrix_test.
+template<template<typename> class Alloc>
+struct matrix_temporaries {
+    static void run(latency_sampler &sample)
+    {
+        constexpr size_t size = 100;
+        using row_t = std::vector<int, Alloc<int>>;
+        std::vector<row_t, Alloc<row_t>> matrix(size, row_t(size, 1));
+
+        int sum = 0;
+        for (const row_t &a : matrix) {
+            for (const row_t &b : matrix) {
+                sample([&]() {
+                    row_t a_copy = a;
+                    row_t b_copy = b;
+                    for (size_t i = 0; i < size; ++i) {
+                        sum += a_copy[i] * b_copy[i];
+                    }
+                });
+            }
+        }
+        if (sum == 0) {
+            std::cerr << "Unexpected result" << std::endl;
+        }
+    }
+};
+
+/// Keeps a window of live blocks of random sizes and replaces random ones.
+template<template<typename> class Alloc>
+struct random_mix {
+    static void run(latency_sampler &sample)
+    {
+        constexpr size_t operations = 200000;
+        constexpr size_t live_blocks = 1024;
+        constexpr size_t max_block_size = 1024;
+
+        Alloc<uint8_t> allocator;
+        std::mt19937 rng{42};
+        std::vector<std::pair<uint8_t *, size_t>> blocks(live_blocks, {nullptr, 0});
+        for (size_t i = 0; i < operations; ++i) {
+            auto &block = blocks[rng() % live_blocks];
+            size_t new_size = 8 + rng() % max_block_size;
+            sample([&]() {
+                if (block.first) {
+                    allocator.deallocate(block.first, block.second);
+                }
+                block.first = allocator.allocate(new_size);
+            });
+            block.second = new_size;
+        }
+        for (auto &block : blocks) {
+            allocator.deallocate(block.first, block.second);
+        }
+    }
+};
+
+/// Single producer allocates messages, single consumer frees them.
+template<template<typename> class Alloc>
+struct producer_consumer {
+    static void run(latency_sampler &sample)
+    {
+        constexpr size_t messages = 200000;
+        constexpr size_t message_size = 64;
+        constexpr size_t queue_size = 1024;
+
+        std::vector<uint8_t *> queue(queue_size);
+        std::atomic<size_t> head{0};
+        std::atomic<size_t> tail{0};
+
+        std::thread consumer([&]() {
+            Alloc<uint8_t> allocator;
+            for (size_t i = 0; i < messages; ++i) {
+                while (head.load(std::memory_order_acquire) == i) {
+                    std::this_thread::yield();
+                }
+                allocator.deallocate(queue[i % queue_size], message_size);
+                tail.store(i + 1, std::memory_order_release);
+            }
+        });
+
+        Alloc<uint8_t> allocator;
+        for (size_t i = 0; i < messages; ++i) {
+            while (i - tail.load(std::memory_order_acquire) == queue_size) {
+                std::this_thread::yield();
+            }
+            sample([&]() {
+                queue[i % queue_size] = allocator.allocate(message_size);
+            });
+            queue[i % queue_size][0] = static_cast<uint8_t>(i);
+            head.store(i + 1, std::memory_order_release);
+        }
+        consumer.join();
+    }
+};
+
+static std::function<void()> init_heap(allocation_strategy strategy, bool thread_safe, bool gap_bitmap = false,
+                                       bool sized_slots = false)
+{
+    return [strategy, thread_safe, gap_bitmap, sized_slots]() {
+        holder::heap.set_thread_safe(thread_safe);
+        holder::heap.set_gap_bitmap(gap_bitmap);
+        holder::heap.set_slab_pools(sized_slots);
+        holder::heap.set_sized_slots(sized_slots);
+        holder::heap(mem.get_data(), mem.get_size(), strategy);
+    };
+}
+
+/// Runs the workload with the heap as the default resource, the previous one is restored afterwards.
+template<template<template<typename> class> class Workload>
+static void run_with_heap_resource(latency_sampler &sample)
+{
+    std::pmr::memory_resource *previous = std::pmr::set_default_resource(&heap_resource);
+    Workload<pmr_allocator>::run(sample);
+    std::pmr::set_default_resource(previous);
+}
+
+/// Leaves the heap empty and gives its pages back, std runs should not count them.
+static void release_heap_memory()
+{
+    holder::heap.reset();
+    holder::heap.purge();
+}
+
+template<template<template<typename> class> class Workload>
+static void add_benchmarks(std::vector<benchmark_t> &benchmarks, const std::string &workload, size_t operations,
+                           bool thread_safe)
+{
+    auto purge_heap = []() {
+        holder::heap.purge();
+    };
+    benchmarks.push_back({workload, "chunk_list", operations,
+                          init_heap(allocation_strategy::chunk_list, thread_safe),
+                          Workload<heap_allocator>::run, purge_heap});
+    benchmarks.push_back({workload, "chunk_bitmap", operations,
+                          init_heap(allocation_strategy::chunk_list, thread_safe, true),
+                          Workload<heap_allocator>::run, purge_heap});
+    benchmarks.push_back({workload, "chunk_next_fit", operations,
+                          init_heap(allocation_strategy::chunk_list, thread_safe),
+                          Workload<next_fit_allocator>::run, purge_heap});
+    benchmarks.push_back({workload, "chunk_best_fit", operations,
+                          init_heap(allocation_strategy::chunk_list, thread_safe),
+                          Workload<best_fit_allocator>::run, purge_heap});
+    benchmarks.push_back({workload, "chunk_list_pmr", operations,
+                          init_heap(allocation_strategy::chunk_list, thread_safe),
+                          run_with_heap_resource<Workload>, purge_heap});
+    benchmarks.push_back({workload, "chunk_slots", operations,
+                          init_heap(allocation_strategy::chunk_list, thread_safe, false, true),
+                          Workload<heap_allocator>::run, purge_heap});
+    benchmarks.push_back({workload, "tlsf", operations,
+                          init_heap(allocation_strategy::tlsf, thread_safe),
+                          Workload<heap_allocator>::run, purge_heap});
+    benchmarks.push_back({workload, "std", operations, release_heap_memory, Workload<std::allocator>::run, []() {
+        malloc_trim(0);
+    }});
+}
+
+int main(int argc, char *argv[])
+{
+    benchmark_options_t options;
+    bool json = false;
+    std::string filter;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--json") {
+            json = true;
+        }
+        else if (arg == "--runs" && i + 1 < argc && std::stol(argv[i + 1]) >= 1) {
+            options.runs = std::stoul(argv[++i]);
+        }
+        else if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        }
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--json] [--runs N >= 1] [--filter substring]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<benchmark_t> benchmarks;
+    add_benchmarks<push_back_growth>(benchmarks, "push_back_growth", 100000, false);
+    add_benchmarks<matrix_temporaries>(benchmarks, "matrix_temporaries", 100 * 100, false);
+    add_benchmarks<random_mix>(benchmarks, "random_mix", 200000, false);
+    add_benchmarks<producer_consumer>(benchmarks, "producer_consumer", 200000, true);
+
+    std::vector<benchmark_result_t> results;
+    for (const benchmark_t &benchmark : benchmarks) {
+        if ((benchmark.workload + "/" + benchmark.allocator).find(filter) == std::string::npos) {
+            continue;
+        }
+        results.push_back(run_benchmark(benchmark, options));
+    }
+
+    if (json) {
+        write_json(std::cout, results);
+    }
+    else {
+        write_table(std::cout, results);
+    }
+}
@@ -0,0 +1,211 @@
+#ifndef BENCHMARK_HPP
+#define BENCHMARK_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "test_common.hpp"
+#include "../os_memory.hpp"
+
+/**
+ * Small benchmark harness. Every benchmark is run a few times to warm up,
+ * then measured over repeated runs with monotonic clocks. Per-operation
+ * latencies come from one extra run in which the workload times each of its
+ * operations, so the clock reads do not disturb the throughput runs.
+ * Resident set size of the process is sampled after the last run, before and
+ * after the allocator is asked to give its free memory back.
+ */
+
+using benchmark_clock = std::chrono::steady_clock;
+
+/// Passed to workloads, times single operations only during the latency run.
+class latency_sampler {
+public:
+    explicit latency_sampler(bool enabled)
+        : enabled{enabled}
+    {}
+
+    template<typename Op>
+    void operator()(Op &&op)
+    {
+        if (!enabled) {
+            op();
+            return;
+        }
+        auto start = benchmark_clock::now();
+        op();
+        auto end = benchmark_clock::now();
+        samples.push_back(std::chrono::duration<double>(end - start).count());
+    }
+
+    std::vector<double> & get_samples()
+    {
+        return samples;
+    }
+
+private:
+    const bool enabled;
+    std::vector<double> samples;
+};
+
+struct benchmark_t {
+    std::string workload;
+    std::string allocator;
+    /// Number of operations one run performs.
+    size_t operations;
+    /// Called before every run, e.g. to re-initialize the heap.
+    std::function<void()> setup;
+    std::function<void(latency_sampler &)> run;
+    /// Gives free memory back to the system after the runs, may be empty.
+    std::function<void()> release;
+};
+
+struct benchmark_options_t {
+    size_t warmup_runs = 2;
+    /// At least one.
+    size_t runs = 10;
+};
+
+struct benchmark_result_t {
+    std::string workload;
+    std::string allocator;
+    size_t operations = 0;
+    size_t runs = 0;
+    double wall_median = 0;
+    double wall_min = 0;
+    double wall_stddev = 0;
+    double cpu_median = 0;
+    double latency_p50 = 0;
+    double latency_p99 = 0;
+    double latency_p999 = 0;
+    size_t rss_after_run = 0;
+    size_t rss_after_release = 0;
+
+    double get_throughput() const
+    {
+        return static_cast<double>(operations) / wall_median;
+    }
+};
+
+inline double get_percentile(std::vector<double> values, double percentile)
+{
+    if (values.empty()) {
+        return 0;
+    }
+    auto nth = values.begin() + static_cast<long>(percentile * static_cast<double>(values.size() - 1));
+    std::nth_element(values.begin(), nth, values.end());
+    return *nth;
+}
+
+inline benchmark_result_t run_benchmark(const benchmark_t &benchmark, const benchmark_options_t &options)
+{
+    assert(options.runs >= 1);
+    latency_sampler untimed{false};
+    for (size_t i = 0; i < options.warmup_runs; ++i) {
+        benchmark.setup();
+        benchmark.run(untimed);
+    }
+
+    std::vector<double> wall_times;
+    std::vector<double> cpu_times;
+    for (size_t i = 0; i < options.runs; ++i) {
+        benchmark.setup();
+        double cpu_before = get_cpu_time();
+        auto wall_before = benchmark_clock::now();
+        benchmark.run(untimed);
+        auto wall_after = benchmark_clock::now();
+        double cpu_after = get_cpu_time();
+        wall_times.push_back(std::chrono::duration<double>(wall_after - wall_before).count());
+        cpu_times.push_back(cpu_after - cpu_before);
+    }
+
+    latency_sampler sampler{true};
+    benchmark.setup();
+    benchmark.run(sampler);
+
+    size_t rss_after_run = get_resident_size();
+    if (benchmark.release) {
+        benchmark.release();
+    }
+    size_t rss_after_release = get_resident_size();
+
+    benchmark_result_t result;
+    result.workload = benchmark.workload;
+    result.allocator = benchmark.allocator;
+    result.operations = benchmark.operations;
+    result.runs = options.runs;
+    result.wall_median = get_percentile(wall_times, 0.5);
+    result.wall_min = *std::min_element(wall_times.begin(), wall_times.end());
+    result.cpu_median = get_percentile(cpu_times, 0.5);
+
+    double mean = 0;
+    for (double time : wall_times) {
+        mean += time / static_cast<double>(wall_times.size());
+    }
+    double variance = 0;
+    for (double time : wall_times) {
+        variance += (time - mean) * (time - mean) / static_cast<double>(wall_times.size());
+    }
+    result.wall_stddev = std::sqrt(variance);
+
+    result.latency_p50 = get_percentile(sampler.get_samples(), 0.5);
+    result.latency_p99 = get_percentile(sampler.get_samples(), 0.99);
+    result.latency_p999 = get_percentile(sampler.get_samples(), 0.999);
+    result.rss_after_run = rss_after_run;
+    result.rss_after_release = rss_after_release;
+    return result;
+}
+
+inline void write_table(std::ostream &out, const std::vector<benchmark_result_t> &results)
+{
+    out << std::left << std::setw(20) << "workload" << std::setw(14) << "allocator"
+        << std::right << std::setw(12) << "wall [ms]" << std::setw(10) << "+- [%]" << std::setw(12) << "cpu [ms]"
+        << std::setw(14) << "Mops/s" << std::setw(10) << "p50 [ns]" << std::setw(10) << "p99 [ns]"
+        << std::setw(12) << "p99.9 [ns]" << std::setw(11) << "rss [MiB]" << std::setw(21) << "after release [MiB]"
+        << std::endl;
+    out << std::fixed << std::setprecision(2);
+    for (const benchmark_result_t &result : results) {
+        out << std::left << std::setw(20) << result.workload << std::setw(14) << result.allocator << std::right
+            << std::setw(12) << result.wall_median * 1e3
+            << std::setw(10) << result.wall_stddev / result.wall_median * 100
+            << std::setw(12) << result.cpu_median * 1e3
+            << std::setw(14) << result.get_throughput() / 1e6
+            << std::setw(10) << result.latency_p50 * 1e9
+            << std::setw(10) << result.latency_p99 * 1e9
+            << std::setw(12) << result.latency_p999 * 1e9
+            << std::setw(11) << static_cast<double>(result.rss_after_run) / (1024 * 1024)
+            << std::setw(21) << static_cast<double>(result.rss_after_release) / (1024 * 1024) << std::endl;
+    }
+    out << std::defaultfloat;
+}
+
+inline void write_json(std::ostream &out, const std::vector<benchmark_result_t> &results)
+{
+    out << "[" << std::endl;
+    for (size_t i = 0; i < results.size(); ++i) {
+        const benchmark_result_t &result = results[i];
+        out << "  {\"workload\": \"" << result.workload << "\", "
+            << "\"allocator\": \"" << result.allocator << "\", "
+            << "\"operations\": " << result.operations << ", "
+            << "\"runs\": " << result.runs << ", "
+            << "\"wall_median_s\": " << result.wall_median << ", "
+            << "\"wall_min_s\": " << result.wall_min << ", "
+            << "\"wall_stddev_s\": " << result.wall_stddev << ", "
+            << "\"cpu_median_s\": " << result.cpu_median << ", "
+            << "\"ops_per_s\": " << result.get_throughput() << ", "
+            << "\"latency_p50_s\": " << result.latency_p50 << ", "
+            << "\"latency_p99_s\": " << result.latency_p99 << ", "
+            << "\"latency_p999_s\": " << result.latency_p999 << ", "
+            << "\"rss_after_run_bytes\": " << result.rss_after_run << ", "
+            << "\"rss_after_release_bytes\": " << result.rss_after_release << "}"
+            << (i + 1 == results.size() ? "" : ",") << std::endl;
+    }
+    out << "]" << std::endl;
+}
+
+#endif //BENCHMARK_HPP
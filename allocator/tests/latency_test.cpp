@@ -0,0 +1,70 @@
+#include <iostream>
+#include <vector>
+#include "test_common.hpp"
+#include "../inblock_allocator.hpp"
+
+/**
+ * Measures latency of one allocate/deallocate pair while the heap holds
+ * growing number of live chunks. Chunk list walks all live chunks, TLSF
+ * should stay flat.
+ */
+
+struct holder {
+    static inblock_allocator_heap heap;
+};
+
+inblock_allocator_heap holder::heap;
+
+constexpr size_t live_chunk_counts[] = {1000, 4000, 16000, 64000};
+constexpr size_t live_chunk_payload = 24;
+constexpr size_t measured_payload = 128;
+constexpr size_t operations = 2000;
+
+const size_t mem_size = 32 * 1024 * 1024;
+
+static double measure_latency(allocation_strategy strategy, size_t live_chunks, std::vector<uint8_t> &mem)
+{
+    holder::heap(mem.data(), mem.size(), strategy);
+    inblock_allocator<uint8_t, holder> allocator;
+
+    std::vector<uint8_t *> live;
+    live.reserve(live_chunks);
+    for (size_t i = 0; i < live_chunks; ++i) {
+        live.push_back(allocator.allocate(live_chunk_payload));
+    }
+
+    double time = measure([&]() {
+        for (size_t i = 0; i < operations; ++i) {
+            uint8_t *data = allocator.allocate(measured_payload);
+            allocator.deallocate(data, measured_payload);
+        }
+    });
+
+    if (holder::heap.is_stats_enabled()) {
+        write_json(std::cout, holder::heap.get_stats());
+        std::cout << std::endl;
+    }
+
+    for (uint8_t *data : live) {
+        allocator.deallocate(data, live_chunk_payload);
+    }
+    return time / operations;
+}
+
+int main()
+{
+    std::vector<uint8_t> mem;
+    mem.resize(mem_size);
+
+    std::cout << "Latency of allocate + deallocate [ns]" << std::endl;
+    std::cout << "live chunks\tchunk list\ttlsf" << std::endl;
+    for (size_t live_chunks : live_chunk_counts) {
+        double chunk_list_latency = measure_latency(allocation_strategy::chunk_list, live_chunks, mem);
+        double tlsf_latency = measure_latency(allocation_strategy::tlsf, live_chunks, mem);
+        std::cout << live_chunks << "\t\t" << chunk_list_latency * 1e9 << "\t\t" << tlsf_latency * 1e9 << std::endl;
+    }
+
+    std::cout << "Chunk list heap statistics with " << live_chunk_counts[0] << " live chunks:" << std::endl;
+    holder::heap.set_stats_enabled(true);
+    measure_latency(allocation_strategy::chunk_list, live_chunk_counts[0], mem);
+}
@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "test_common.hpp"
+
+/**
+ * Ordinary program that allocates by malloc and operator new only, so it
+ * measures whichever allocator the process ends up with:
+ *
+ *     malloc_test                                     malloc of libc
+ *     LD_PRELOAD=./libinblock_malloc.so malloc_test   the heap for malloc and new
+ *     malloc_test_new                                 the heap for new only
+ */
+
+constexpr size_t keys_count = 200000;
+constexpr size_t thread_count = 4;
+constexpr size_t thread_operations = 1000000;
+
+/// Map of strings to small vectors, filled and emptied in random order.
+static void run_string_map()
+{
+    std::vector<std::string> keys;
+    keys.reserve(keys_count);
+    for (size_t i = 0; i < keys_count; ++i) {
+        keys.push_back("key number " + std::to_string(i * 7919 % keys_count));
+    }
+    std::map<std::string, std::vector<int>> values;
+    for (const std::string &key : keys) {
+        values[key].assign(key.size(), 1);
+    }
+    std::shuffle(keys.begin(), keys.end(), std::mt19937{42});
+    for (const std::string &key : keys) {
+        values.erase(key);
+    }
+}
+
+/// Buffers grown by realloc in small steps, as a string builder does.
+static void run_realloc_growth()
+{
+    constexpr size_t buffers_count = 16;
+    constexpr size_t step = 256;
+    constexpr size_t final_size = 4 * 1024 * 1024;
+    std::vector<char *> buffers(buffers_count, nullptr);
+    for (size_t size = step; size <= final_size; size += step) {
+        for (char *&buffer : buffers) {
+            buffer = static_cast<char *>(std::realloc(buffer, size));
+            buffer[size - 1] = 1;
+        }
+    }
+    for (char *buffer : buffers) {
+        std::free(buffer);
+    }
+}
+
+/// Threads that keep a working set of small objects and replace them at random.
+static void run_threads()
+{
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < thread_count; ++t) {
+        threads.emplace_back([t]() {
+            std::mt19937 rng{static_cast<unsigned>(t)};
+            std::vector<std::unique_ptr<char[]>> objects(1024);
+            for (size_t i = 0; i < thread_operations; ++i) {
+                auto &object = objects[rng() % objects.size()];
+                object.reset(new char[16 + rng() % 512]);
+                object[0] = static_cast<char>(i);
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+}
+
+int main()
+{
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "string_map      " << measure(run_string_map) * 1000 << " ms" << std::endl;
+    std::cout << "realloc_growth  " << measure(run_realloc_growth) * 1000 << " ms" << std::endl;
+    std::cout << "threads         " << measure(run_threads) * 1000 << " ms" << std::endl;
+}
@@ -1,4 +1,3 @@
-
 #include <cassert>
 #include <iostream>
 #include <vector>
@@ -10,13 +9,14 @@
 //uncomment this to use std::allocator
 //#define USE_STD_ALLOCATOR
 
+#include "../inblock_allocator.hpp"
+
 #ifdef USE_STD_ALLOCATOR
 
 template<typename V>
 using Vector = std::vector<V>;
 
 #else
-#include "../inblock_allocator.hpp"
 
 struct holder {
 	static inblock_allocator_heap heap;
@@ -28,16 +28,36 @@ template<typename V>
 using Vector = std::vector<V, inblock_allocator<V, holder>>;
 #endif
 
+struct arena_holder {
+    static inblock_allocator_heap heap;
+};
+
+inblock_allocator_heap arena_holder::heap;
+
+template<typename V>
+using ArenaVector = std::vector<V, inblock_allocator<V, arena_holder>>;
+
 template<typename V>
 using StdVector = std::vector<V>;
 
 using Vec = Vector<int>;
+using ArenaVec = ArenaVector<int>;
 using StdVec = StdVector<int>;
 using Matrix = Vector<Vec>;
+using ArenaMatrix = ArenaVector<ArenaVec>;
 using StdMatrix = StdVector<StdVec>;
 
+/// Phase of the computation whose temporaries may be dropped at once.
+struct no_phase {
+};
+
+struct arena_phase {
+    arena_scope scope{arena_holder::heap};
+};
+
 
-int ugly_dot(Vec a, Vec b)
+template<typename V>
+int ugly_dot(V a, V b)
 {
 	assert (a.size () == b.size ());
 	int res = 0;
@@ -45,46 +65,38 @@ int ugly_dot(Vec a, Vec b)
 	return res;
 }
 
-Matrix ugly_mult_matrix(Matrix a, Matrix b)
+template<typename M, typename Phase>
+M ugly_mult_matrix(M a, M b)
 {
-	Matrix c;
+	using V = typename M::value_type;
+	M c;
 	for (auto&& i : a) {
-		Vec tmp;
-		for (auto&& j : b) tmp.push_back (ugly_dot (i, j));
+		V tmp;
+		for (auto&& j : b) {
+			int dot;
+			{
+				// Copies of the arguments die here.
+				[[maybe_unused]] Phase phase;
+				dot = ugly_dot (i, j);
+			}
+			tmp.push_back (dot);
+		}
 		c.push_back (tmp);
 	}
 	return c;
 }
 
-int std_ugly_dot(StdVec a, StdVec b)
-{
-    assert (a.size () == b.size ());
-    int res = 0;
-    for (size_t i = 0; i < a.size (); ++i) res += a[i] * b[i];
-    return res;
-}
-
-StdMatrix std_ugly_mult_matrix(StdMatrix a, StdMatrix b)
-{
-    StdMatrix c;
-    for (auto&& i : a) {
-        StdVec tmp;
-        for (auto&& j : b) tmp.push_back (std_ugly_dot (i, j));
-        c.push_back (tmp);
-    }
-    return c;
-}
-
 #define SIZE 200
 
 #define memsize (SIZE * SIZE * sizeof (int) * 4 * 10)
 
-static void run_myalloc()
+template<typename M, typename Phase>
+static void run_alloc()
 {
-    Matrix a;
+    M a;
     a.resize (SIZE);
     for (size_t i = 0; i < SIZE; ++i) a[i].resize (SIZE);
-    Matrix b = a;
+    M b = a;
 
     srand (0x1337);
     for (size_t i = 0; i < SIZE; ++i)
@@ -93,9 +105,9 @@ static void run_myalloc()
             b[i][j] = rand () % 3;
         }
 
-    a = ugly_mult_matrix (a, b);
-    a = ugly_mult_matrix (a, b);
-    a = ugly_mult_matrix (a, b);
+    a = ugly_mult_matrix<M, Phase> (a, b);
+    a = ugly_mult_matrix<M, Phase> (a, b);
+    a = ugly_mult_matrix<M, Phase> (a, b);
 
     for (size_t i = 0; i < SIZE; ++i) {
         for (size_t j = 0; j < SIZE; ++j) {
@@ -105,54 +117,86 @@ static void run_myalloc()
     }
 }
 
-static void run_stdalloc()
+#ifndef USE_STD_ALLOCATOR
+/**
+ * Allocates the rows of a matrix one by one and in one batch while another
+ * matrix lives in front of them, so every single allocation walks past it.
+ * @return Wall times of both ways.
+ */
+static std::pair<double, double> measure_row_allocation()
 {
-    StdMatrix a;
-    a.resize (SIZE);
-    for (size_t i = 0; i < SIZE; ++i) a[i].resize (SIZE);
-    StdMatrix b = a;
-
-    srand (0x1337);
-    for (size_t i = 0; i < SIZE; ++i)
-        for (size_t j = 0; j < SIZE; ++j) {
-            a[i][j] = rand () % 3;
-            b[i][j] = rand () % 3;
+    constexpr size_t repetitions = 100;
+    Matrix live(SIZE, Vec(SIZE));
+    inblock_allocator<int, holder> allocator;
+    std::vector<int *> rows(SIZE);
+
+    double single_time = measure([&]() {
+        for (size_t rep = 0; rep < repetitions; ++rep) {
+            for (int *&row : rows) {
+                row = allocator.allocate(SIZE);
+            }
+            allocator.deallocate_batch(rows.data(), rows.size(), SIZE);
         }
-
-    a = std_ugly_mult_matrix (a, b);
-    a = std_ugly_mult_matrix (a, b);
-    a = std_ugly_mult_matrix (a, b);
-
-    for (size_t i = 0; i < SIZE; ++i) {
-        for (size_t j = 0; j < SIZE; ++j) {
-            //std::cout << a[i][j] << ' ';
+    });
+    double batch_time = measure([&]() {
+        for (size_t rep = 0; rep < repetitions; ++rep) {
+            allocator.allocate_batch(SIZE, rows.size(), rows.data());
+            allocator.deallocate_batch(rows.data(), rows.size(), SIZE);
         }
-        //std::cout << std::endl;
-    }
+    });
+    return {single_time / repetitions, batch_time / repetitions};
 }
+#endif
 
 int main ()
 {
     boost::log::core::get()->set_filter(boost::log::trivial::severity >= boost::log::trivial::warning);
 
+    // Huge pages and no page faults during the timed runs.
+    const mapping_options_t mapping_options{true, true};
+
 #ifndef USE_STD_ALLOCATOR
-	std::vector<uint8_t> mem;
-	mem.resize (memsize);
+	mapped_region mem{memsize, mapping_options};
 
-	holder::heap (mem.data (), memsize);
+	holder::heap (mem.get_data (), mem.get_size ());
+	std::cout << "Huge pages = " << (mem.get_backing () != page_backing::base) << std::endl;
 #endif
 
-    double my_wall_time = measure(run_myalloc);
+    mapped_region arena_mem{memsize, mapping_options};
+
+    arena_holder::heap (arena_mem.get_data (), arena_mem.get_size (), allocation_strategy::monotonic);
+
+    double my_wall_time = measure(run_alloc<Matrix, no_phase>);
 
     std::cout << "Times for my allocator:" << std::endl;
     std::cout << "\tWall Time = " << my_wall_time << std::endl;
 
+#ifndef USE_STD_ALLOCATOR
+    // Separate run, so the counters do not influence the time.
+    holder::heap.set_stats_enabled(true);
+    run_alloc<Matrix, no_phase>();
+    std::cout << "\tPeak footprint = " << holder::heap.get_stats().counters.high_water_mark << " B" << std::endl;
+    holder::heap.set_stats_enabled(false);
+
+    auto [single_time, batch_time] = measure_row_allocation();
+    std::cout << "\tRows allocated one by one = " << single_time << std::endl;
+    std::cout << "\tRows allocated in one batch = " << batch_time << std::endl;
+#endif
+
+    // ==========
+    double arena_wall_time = measure(run_alloc<ArenaMatrix, arena_phase>);
+    arena_holder::heap.reset();
+
+    std::cout << "Times for monotonic arena:" << std::endl;
+    std::cout << "\tWall Time = " << arena_wall_time << std::endl;
+
     // ==========
-    double std_wall_time = measure(run_stdalloc);
+    double std_wall_time = measure(run_alloc<StdMatrix, no_phase>);
 
     std::cout << "Times for std allocator:" << std::endl;
     std::cout << "\tWall Time = " << std_wall_time << std::endl;
 
     std::cout << "Slowdown of my allocator = " << count_slowdown(std_wall_time, my_wall_time) << std::endl;
+    std::cout << "Slowdown of monotonic arena = " << count_slowdown(std_wall_time, arena_wall_time) << std::endl;
 
-}
\ No newline at end of file
+}
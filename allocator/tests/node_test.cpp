@@ -0,0 +1,187 @@
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <list>
+#include <map>
+#include <numeric>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "test_common.hpp"
+#include "../inblock_allocator.hpp"
+
+/**
+ * Throughput of node containers, which allocate one node per element, on the
+ * heap and on std::allocator. Insert, lookup and erase are timed apart, keys
+ * come in random order so that erased nodes leave gaps all over the heap.
+ * Lookup in the list is a traversal of all nodes. Every phase is the best of
+ * a few runs.
+ *
+ * Chunk list heap alone runs next fit, first fit would walk all live nodes
+ * on every insert. With slabs the heap sees one block per slab only.
+ */
+
+struct holder {
+    static inblock_allocator_heap heap;
+};
+
+inblock_allocator_heap holder::heap;
+
+template<typename T>
+using heap_allocator = inblock_allocator<T, holder>;
+
+template<typename T>
+using next_fit_allocator = inblock_allocator<T, holder, next_fit>;
+
+constexpr size_t elements = 200000;
+constexpr size_t runs = 5;
+
+const size_t mem_size = 64 * 1024 * 1024;
+
+/// Seconds spent in every phase.
+struct phase_times_t {
+    double insert;
+    double lookup;
+    double erase;
+};
+
+template<template<typename> class Alloc>
+struct list_workload {
+    static phase_times_t run(const std::vector<uint64_t> &keys)
+    {
+        using list_t = std::list<uint64_t, Alloc<uint64_t>>;
+        list_t values;
+        std::vector<typename list_t::iterator> positions;
+        positions.reserve(keys.size());
+        phase_times_t times{};
+
+        times.insert = measure([&]() {
+            for (uint64_t key : keys) {
+                positions.push_back(values.insert(values.end(), key));
+            }
+        });
+        uint64_t sum = 0;
+        times.lookup = measure([&]() {
+            sum = std::accumulate(values.begin(), values.end(), uint64_t{0});
+        });
+        // Positions follow the keys, which are shuffled, so the erased nodes are scattered.
+        std::sort(positions.begin(), positions.end(), [](auto a, auto b) {
+            return *a < *b;
+        });
+        times.erase = measure([&]() {
+            for (auto position : positions) {
+                values.erase(position);
+            }
+        });
+        if (sum == 0 || !values.empty()) {
+            std::cerr << "Unexpected result" << std::endl;
+        }
+        return times;
+    }
+};
+
+template<typename Map>
+static phase_times_t run_map(const std::vector<uint64_t> &keys)
+{
+    Map values;
+    phase_times_t times{};
+    times.insert = measure([&]() {
+        for (uint64_t key : keys) {
+            values.emplace(key, key);
+        }
+    });
+    uint64_t sum = 0;
+    times.lookup = measure([&]() {
+        for (uint64_t key = 0; key < keys.size(); ++key) {
+            sum += values.find(key)->second;
+        }
+    });
+    times.erase = measure([&]() {
+        for (uint64_t key = 0; key < keys.size(); ++key) {
+            values.erase(key);
+        }
+    });
+    if (sum == 0 || !values.empty()) {
+        std::cerr << "Unexpected result" << std::endl;
+    }
+    return times;
+}
+
+template<template<typename> class Alloc>
+struct map_workload {
+    static phase_times_t run(const std::vector<uint64_t> &keys)
+    {
+        using value_t = std::pair<const uint64_t, uint64_t>;
+        return run_map<std::map<uint64_t, uint64_t, std::less<uint64_t>, Alloc<value_t>>>(keys);
+    }
+};
+
+template<template<typename> class Alloc>
+struct unordered_map_workload {
+    static phase_times_t run(const std::vector<uint64_t> &keys)
+    {
+        using value_t = std::pair<const uint64_t, uint64_t>;
+        return run_map<std::unordered_map<uint64_t, uint64_t, std::hash<uint64_t>, std::equal_to<uint64_t>,
+                                          Alloc<value_t>>>(keys);
+    }
+};
+
+/// Best time of every phase over the runs, setup re-initializes the heap before each run.
+template<typename Workload, typename Setup>
+static phase_times_t measure_best(const std::vector<uint64_t> &keys, Setup setup)
+{
+    phase_times_t best{1e9, 1e9, 1e9};
+    for (size_t i = 0; i < runs; ++i) {
+        setup();
+        phase_times_t times = Workload::run(keys);
+        best.insert = std::min(best.insert, times.insert);
+        best.lookup = std::min(best.lookup, times.lookup);
+        best.erase = std::min(best.erase, times.erase);
+    }
+    return best;
+}
+
+static void print_row(const std::string &container, const std::string &allocator, const phase_times_t &times)
+{
+    std::cout << std::left << std::setw(16) << container << std::setw(20) << allocator << std::right
+              << std::setw(14) << elements / times.insert / 1e6
+              << std::setw(14) << elements / times.lookup / 1e6
+              << std::setw(14) << elements / times.erase / 1e6 << std::endl;
+}
+
+template<template<template<typename> class> class Workload>
+static void run_container(const std::string &container, const std::vector<uint64_t> &keys, std::vector<uint8_t> &mem)
+{
+    auto init_heap = [&mem](allocation_strategy strategy, bool slab_pools) {
+        return [&mem, strategy, slab_pools]() {
+            holder::heap.set_slab_pools(slab_pools);
+            holder::heap(mem.data(), mem.size(), strategy);
+        };
+    };
+    print_row(container, "chunk_list", measure_best<Workload<next_fit_allocator>>(
+        keys, init_heap(allocation_strategy::chunk_list, false)));
+    print_row(container, "chunk_list + slabs", measure_best<Workload<heap_allocator>>(
+        keys, init_heap(allocation_strategy::chunk_list, true)));
+    print_row(container, "tlsf", measure_best<Workload<heap_allocator>>(
+        keys, init_heap(allocation_strategy::tlsf, false)));
+    print_row(container, "tlsf + slabs", measure_best<Workload<heap_allocator>>(
+        keys, init_heap(allocation_strategy::tlsf, true)));
+    print_row(container, "std", measure_best<Workload<std::allocator>>(keys, []() {}));
+}
+
+int main()
+{
+    std::vector<uint8_t> mem(mem_size);
+    std::vector<uint64_t> keys(elements);
+    std::iota(keys.begin(), keys.end(), uint64_t{0});
+    std::shuffle(keys.begin(), keys.end(), std::mt19937{42});
+
+    std::cout << "Node container throughput with " << elements << " elements [Mops/s]" << std::endl;
+    std::cout << std::left << std::setw(16) << "container" << std::setw(20) << "allocator" << std::right
+              << std::setw(14) << "insert" << std::setw(14) << "lookup" << std::setw(14) << "erase" << std::endl;
+    std::cout << std::fixed << std::setprecision(2);
+    run_container<list_workload>("list", keys, mem);
+    run_container<map_workload>("map", keys, mem);
+    run_container<unordered_map_workload>("unordered_map", keys, mem);
+}
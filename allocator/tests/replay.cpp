@@ -0,0 +1,239 @@
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "benchmark.hpp"
+#include "../inblock_allocator.hpp"
+#include "../inblock_vector.hpp"
+#include "../os_memory.hpp"
+#include "../trace.hpp"
+
+/**
+ * Replays an allocation trace recorded by trace_recorder against every
+ * allocation strategy and std::allocator.
+ *
+ * Usage:
+ *   replay <trace> [heap bytes]    replays the trace
+ *   replay --record-sample <trace> records a sample workload into the trace
+ *
+ * Every allocator replays the trace twice. Throughput comes from the first
+ * replay, timed as a whole. Footprint is how much the peak resident set size
+ * of the process grew during it, the same measure for every allocator. The
+ * inblock heap lives in a fresh mapping, so only the pages it touches count.
+ * The second replay times every operation for the latency percentiles.
+ */
+
+struct holder {
+    static inblock_allocator_heap heap;
+};
+
+inblock_allocator_heap holder::heap;
+
+struct replay_result_t {
+    bool completed = true;
+    double total_time = 0;
+    std::vector<double> latencies;
+    size_t footprint = 0;
+};
+
+struct block_t {
+    uint8_t *ptr = nullptr;
+    size_t size = 0;
+};
+
+/// Replays allocations through inblock_allocator, resizes try the in-place path first.
+struct inblock_replayer {
+    inblock_allocator<uint8_t, holder> allocator;
+
+    uint8_t * allocate(size_t size)
+    {
+        return allocator.allocate(size);
+    }
+
+    void deallocate(uint8_t *ptr, size_t size)
+    {
+        allocator.deallocate(ptr, size);
+    }
+
+    uint8_t * resize(uint8_t *ptr, size_t size, size_t new_size)
+    {
+        if (allocator.try_expand(ptr, size, std::max(size, new_size))) {
+            if (new_size < size) {
+                allocator.try_shrink(ptr, size, new_size);
+            }
+            return ptr;
+        }
+        uint8_t *new_ptr = allocate(new_size);
+        std::memcpy(new_ptr, ptr, std::min(size, new_size));
+        deallocate(ptr, size);
+        return new_ptr;
+    }
+};
+
+struct std_replayer {
+    std::allocator<uint8_t> allocator;
+
+    uint8_t * allocate(size_t size)
+    {
+        return allocator.allocate(size);
+    }
+
+    void deallocate(uint8_t *ptr, size_t size)
+    {
+        allocator.deallocate(ptr, size);
+    }
+
+    uint8_t * resize(uint8_t *ptr, size_t size, size_t new_size)
+    {
+        uint8_t *new_ptr = allocate(new_size);
+        std::memcpy(new_ptr, ptr, std::min(size, new_size));
+        deallocate(ptr, size);
+        return new_ptr;
+    }
+};
+
+/// @return false when the allocator ran out of memory.
+template<typename Replayer>
+static bool run_trace(const std::vector<trace_record_t> &trace, std::vector<block_t> &blocks, latency_sampler &sampler)
+{
+    Replayer replayer;
+    bool completed = true;
+    try {
+        for (const trace_record_t &record : trace) {
+            block_t &block = blocks[record.id];
+            sampler([&]() {
+                if (record.op == trace_op::allocate) {
+                    block.ptr = replayer.allocate(record.size);
+                    block.size = record.size;
+                }
+                else if (record.op == trace_op::deallocate) {
+                    replayer.deallocate(block.ptr, block.size);
+                    block.ptr = nullptr;
+                }
+                else {
+                    block.ptr = replayer.resize(block.ptr, block.size, record.size);
+                    block.size = record.size;
+                }
+            });
+        }
+    }
+    catch (const allocator_exception &) {
+        completed = false;
+    }
+
+    for (block_t &block : blocks) {
+        if (block.ptr) {
+            replayer.deallocate(block.ptr, block.size);
+            block.ptr = nullptr;
+        }
+    }
+    return completed;
+}
+
+/// @param setup Prepares a fresh heap before every replay.
+template<typename Replayer>
+static replay_result_t replay(const std::vector<trace_record_t> &trace, size_t blocks_count,
+                              const std::function<void()> &setup)
+{
+    std::vector<block_t> blocks(blocks_count);
+    replay_result_t result;
+
+    setup();
+    latency_sampler untimed{false};
+    reset_peak_resident_size();
+    size_t rss_before = get_resident_size();
+    auto start = benchmark_clock::now();
+    result.completed = run_trace<Replayer>(trace, blocks, untimed);
+    result.total_time = std::chrono::duration<double>(benchmark_clock::now() - start).count();
+    size_t peak_rss = get_peak_resident_size();
+    result.footprint = peak_rss > rss_before ? peak_rss - rss_before : 0;
+    if (!result.completed) {
+        return result;
+    }
+
+    setup();
+    latency_sampler sampler{true};
+    run_trace<Replayer>(trace, blocks, sampler);
+    result.latencies = std::move(sampler.get_samples());
+    return result;
+}
+
+static void print_result(const std::string &name, const replay_result_t &result, size_t operations)
+{
+    std::cout << name << "\t";
+    if (!result.completed) {
+        std::cout << "run out of memory" << std::endl;
+        return;
+    }
+    std::cout << static_cast<double>(operations) / result.total_time / 1e6 << "\t\t"
+              << get_percentile(result.latencies, 0.5) * 1e9 << "\t"
+              << get_percentile(result.latencies, 0.99) * 1e9 << "\t"
+              << get_percentile(result.latencies, 0.999) * 1e9 << "\t"
+              << result.footprint / 1024 << std::endl;
+}
+
+/// Workload of many growing and dropped vectors, so there is something to replay without a production trace.
+static void record_sample(const std::string &path)
+{
+    std::vector<uint8_t> mem(64 * 1024 * 1024);
+    holder::heap(mem.data(), mem.size(), allocation_strategy::tlsf);
+    trace_recorder recorder{path};
+    holder::heap.set_trace_recorder(&recorder);
+    {
+        using string_vector = inblock_vector<char, holder>;
+        inblock_vector<string_vector, holder> strings;
+        strings.resize(20000);
+        for (size_t i = 0; i < 100000; ++i) {
+            string_vector &value = strings[(i * 7919) % 20000];
+            for (size_t j = 0; j < i % 37; ++j) {
+                value.push_back(static_cast<char>(j));
+            }
+            if (i % 3 == 0) {
+                strings[(i * 104729) % 20000] = string_vector{};
+            }
+        }
+    }
+    holder::heap.set_trace_recorder(nullptr);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc == 3 && std::string{argv[1]} == "--record-sample") {
+        record_sample(argv[2]);
+        return 0;
+    }
+    if (argc < 2 || argc > 3) {
+        std::cerr << "Usage: " << argv[0] << " <trace> [heap bytes]" << std::endl;
+        std::cerr << "       " << argv[0] << " --record-sample <trace>" << std::endl;
+        return 1;
+    }
+
+    std::vector<trace_record_t> trace = read_trace(argv[1]);
+    size_t heap_size = argc == 3 ? std::stoull(argv[2]) : 256 * 1024 * 1024;
+    size_t blocks_count = 0;
+    for (const trace_record_t &record : trace) {
+        blocks_count = std::max<size_t>(blocks_count, record.id + 1);
+    }
+
+    std::cout << "Operations = " << trace.size() << std::endl;
+    std::cout << "allocator\tthroughput [Mops/s]\tp50 [ns]\tp99 [ns]\tp99.9 [ns]\tfootprint [KiB]" << std::endl;
+
+    const std::pair<const char *, allocation_strategy> strategies[] = {
+        {"chunk list", allocation_strategy::chunk_list},
+        {"tlsf\t", allocation_strategy::tlsf},
+        {"monotonic", allocation_strategy::monotonic},
+    };
+    for (auto [name, strategy] : strategies) {
+        std::unique_ptr<mapped_region> region;
+        auto setup = [&region, heap_size, strategy = strategy]() {
+            region.reset();
+            region = std::make_unique<mapped_region>(heap_size);
+            holder::heap(region->get_data(), region->get_size(), strategy);
+        };
+        print_result(name, replay<inblock_replayer>(trace, blocks_count, setup), trace.size());
+    }
+    print_result("std\t", replay<std_replayer>(trace, blocks_count, []() {}), trace.size());
+}
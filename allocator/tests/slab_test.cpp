@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "test_common.hpp"
+#include "../inblock_allocator.hpp"
+
+/**
+ * Allocates and frees many single small objects, the way node based containers
+ * do, with and without slab pools. Footprint is the memory between heap start
+ * and end of the last chunk.
+ */
+
+struct holder {
+    static inblock_allocator_heap heap;
+};
+
+inblock_allocator_heap holder::heap;
+
+constexpr size_t objects_count = 10 * 1000;
+constexpr size_t repetitions = 5;
+
+const size_t mem_size = 64 * 1024 * 1024;
+
+template <size_t Size>
+struct object_t {
+    uint8_t data[Size];
+};
+
+static size_t get_footprint()
+{
+    address_t used_end = holder::heap.get_start_addr();
+    holder::heap.for_each_chunk([&](void *payload, size_t payload_size, bool used) {
+        if (used) {
+            used_end = reinterpret_cast<address_t>(payload) + payload_size;
+        }
+    });
+    return used_end - holder::heap.get_start_addr();
+}
+
+template <size_t Size>
+static void run(bool slab_pools, std::vector<uint8_t> &mem)
+{
+    holder::heap.set_slab_pools(slab_pools);
+    holder::heap(mem.data(), mem.size());
+
+    using object = object_t<Size>;
+    inblock_allocator<object, holder> allocator;
+    std::vector<object *> objects(objects_count);
+    size_t footprint = 0;
+
+    double alloc_time = 0;
+    double dealloc_time = 0;
+    for (size_t rep = 0; rep < repetitions; ++rep) {
+        alloc_time += measure([&]() {
+            for (size_t i = 0; i < objects_count; ++i) {
+                objects[i] = allocator.allocate(1);
+            }
+        });
+        footprint = get_footprint();
+
+        std::shuffle(objects.begin(), objects.end(), std::mt19937{static_cast<unsigned>(rep)});
+        dealloc_time += measure([&]() {
+            for (size_t i = 0; i < objects_count; ++i) {
+                allocator.deallocate(objects[i], 1);
+            }
+        });
+    }
+
+    double ops = static_cast<double>(objects_count * repetitions);
+    std::cout << Size << "\t" << (slab_pools ? "slabs" : "chunks") << "\t"
+              << alloc_time / ops * 1e9 << "\t\t" << dealloc_time / ops * 1e9 << "\t\t"
+              << static_cast<double>(footprint) / objects_count << std::endl;
+}
+
+int main()
+{
+    std::vector<uint8_t> mem;
+    mem.resize(mem_size);
+
+    std::cout << "Objects = " << objects_count << std::endl;
+    std::cout << "size\tmode\talloc [ns]\tdealloc [ns]\tbytes per object" << std::endl;
+    run<16>(false, mem);
+    run<16>(true, mem);
+    run<32>(false, mem);
+    run<32>(true, mem);
+    run<64>(false, mem);
+    run<64>(true, mem);
+}
@@ -1,22 +1,22 @@
 #ifndef TEST_COMMON_HPP
 #define TEST_COMMON_HPP
 
-#include <sys/time.h>
+#include <chrono>
+#include <ctime>
 #include <functional>
 
+/// Seconds on a monotonic clock, only differences are meaningful.
 inline double get_wall_time()
 {
-    struct timeval time;
-    if (gettimeofday(&time, nullptr)){
-        //  Handle error
-        return 0;
-    }
-    return (double)time.tv_sec + (double)time.tv_usec * .000001;
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration<double>(now).count();
 }
 
 inline double get_cpu_time()
 {
-    return (double)clock() / CLOCKS_PER_SEC;
+    timespec time{};
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+    return static_cast<double>(time.tv_sec) + static_cast<double>(time.tv_nsec) * 1e-9;
 }
 
 inline double count_slowdown(double std_time, double my_time)
@@ -24,6 +24,7 @@ inline double count_slowdown(double std_time, double my_time)
     return my_time / std_time;
 }
 
+/// Single run, see benchmark.hpp and bench_suite for repeated measurements.
 inline double measure(std::function<void(void)> func)
 {
     double wall_time_before = get_wall_time();
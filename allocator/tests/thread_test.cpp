@@ -0,0 +1,79 @@
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+#include "test_common.hpp"
+#include "../inblock_allocator.hpp"
+
+/**
+ * Every thread keeps a window of live small blocks and keeps replacing random
+ * blocks of the window. Total amount of work grows with number of threads, so
+ * perfect scaling keeps the wall time flat.
+ */
+
+struct holder {
+    static inblock_allocator_heap heap;
+};
+
+inblock_allocator_heap holder::heap;
+
+constexpr size_t operations_per_thread = 1000 * 1000;
+constexpr size_t live_blocks = 64;
+constexpr size_t max_block_size = 256;
+
+const size_t mem_size = 64 * 1024 * 1024;
+// Heap memory has to outlive thread caches of all threads, including the main one.
+static std::vector<uint8_t> mem(mem_size);
+
+template <typename Allocator>
+static void run_thread(unsigned seed)
+{
+    Allocator allocator;
+    std::mt19937 rng{seed};
+    std::vector<std::pair<uint8_t *, size_t>> blocks(live_blocks, {nullptr, 0});
+
+    for (size_t i = 0; i < operations_per_thread; ++i) {
+        auto &block = blocks[rng() % live_blocks];
+        if (block.first) {
+            allocator.deallocate(block.first, block.second);
+        }
+        block.second = 1 + rng() % max_block_size;
+        block.first = allocator.allocate(block.second);
+        block.first[0] = static_cast<uint8_t>(i);
+    }
+
+    for (auto &block : blocks) {
+        allocator.deallocate(block.first, block.second);
+    }
+}
+
+template <typename Allocator>
+static double run_threads(size_t threads_count)
+{
+    return measure([threads_count]() {
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < threads_count; ++i) {
+            threads.emplace_back(run_thread<Allocator>, static_cast<unsigned>(i + 1));
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    });
+}
+
+int main()
+{
+    holder::heap.set_thread_safe(true);
+    holder::heap(mem.data(), mem_size, allocation_strategy::tlsf);
+
+    size_t max_threads = std::max<size_t>(4, std::thread::hardware_concurrency());
+    std::cout << "Operations per thread = " << operations_per_thread << std::endl;
+    std::cout << "threads\tmy allocator [s]\tstd allocator [s]\tslowdown" << std::endl;
+    for (size_t threads_count = 1; threads_count <= max_threads; ++threads_count) {
+        double my_wall_time = run_threads<inblock_allocator<uint8_t, holder>>(threads_count);
+        double std_wall_time = run_threads<std::allocator<uint8_t>>(threads_count);
+        std::cout << threads_count << "\t" << my_wall_time << "\t\t\t" << std_wall_time << "\t\t\t"
+                  << count_slowdown(std_wall_time, my_wall_time) << std::endl;
+    }
+}
@@ -1,12 +1,31 @@
 
 #define BOOST_TEST_MODULE My_test
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <list>
+#include <map>
 #include <memory>
 #include <functional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <cstdio>
+#include <numeric>
+#include <sys/wait.h>
 #include <boost/test/included/unit_test.hpp>
+#include <boost/test/data/test_case.hpp>
+#include <boost/test/data/monomorphic.hpp>
 #include <ostream>
 #include "../inblock_allocator.hpp"
+#include "../inblock_vector.hpp"
+#include "../inblock_memory_resource.hpp"
+#include "../inblock_malloc.hpp"
+#include "../heap_file.hpp"
+#include "../shared_heap.hpp"
 #include "../common.hpp"
 #include "../chunk.hpp"
 
@@ -46,7 +65,7 @@ static bool is_payload_aligned(const chunk_t *chunk)
 
 static bool is_chunk_in_initialized_state(const chunk_t *chunk)
 {
-    return chunk->payload_size > 0 && chunk->used == 0;
+    return get_payload_size(chunk) > 0 && !is_used(chunk);
 }
 
 static void fill_memory_region_with_random_data(intptr_t start_addr, intptr_t end_addr)
@@ -153,24 +172,21 @@ bool operator==(const allocator_stats_t &stats_1, const allocator_stats_t &stats
 }
 
 template <typename T, typename HeapHolder>
-allocator_stats_t get_allocator_stats(const inblock_allocator<T, HeapHolder> &allocator)
+allocator_stats_t get_allocator_stats(const inblock_allocator<T, HeapHolder> &)
 {
     allocator_stats_t stats{};
-    stats.available_mem_size = diff(inblock_allocator<T, HeapHolder>::heap_type::get_start_addr(),
-            inblock_allocator<T, HeapHolder>::heap_type::get_end_addr());
-
-    const chunk_t *chunk_list = allocator.get_chunk_list();
+    stats.available_mem_size = diff(HeapHolder::heap.get_start_addr(), HeapHolder::heap.get_end_addr());
 
     stats.used_mem_size = 0;
     stats.used_chunks = 0;
     stats.used_mem_size_with_chunk_headers = 0;
-    const chunk_t *chunk = chunk_list;
-    while (chunk) {
-        stats.used_chunks++;
-        stats.used_mem_size += chunk->payload_size;
-        stats.used_mem_size_with_chunk_headers += chunk_header_size + chunk->payload_size;
-        chunk = chunk->next;
-    }
+    HeapHolder::heap.for_each_chunk([&](void *, size_t payload_size, bool used) {
+        if (used) {
+            stats.used_chunks++;
+            stats.used_mem_size += payload_size;
+            stats.used_mem_size_with_chunk_headers += chunk_header_size + payload_size;
+        }
+    });
 
     return stats;
 }
@@ -198,6 +214,29 @@ static void init_heap(size_t mem_size)
     holder::heap((void *)start_addr, num_bytes);
 }
 
+static void init_heap(size_t mem_size, allocation_strategy strategy)
+{
+    auto [start_addr, end_addr] = get_aligned_memory_region(mem_size);
+    fill_memory_region_with_random_data(start_addr, end_addr);
+    holder::heap((void *)start_addr, diff(start_addr, end_addr), strategy);
+}
+
+/// Strategies with freeing, tests of features common to both run on each of them.
+static const allocation_strategy freeing_strategies[] = {allocation_strategy::chunk_list, allocation_strategy::tlsf};
+
+std::ostream &operator<<(std::ostream &os, allocation_strategy strategy)
+{
+    switch (strategy) {
+        case allocation_strategy::chunk_list:
+            return os << "chunk_list";
+        case allocation_strategy::tlsf:
+            return os << "tlsf";
+        case allocation_strategy::monotonic:
+            return os << "monotonic";
+    }
+    return os;
+}
+
 BOOST_AUTO_TEST_CASE(allocator_allocated_data_are_aligned_test)
 {
     init_heap(10 * 1024);
@@ -398,4 +437,2372 @@ BOOST_AUTO_TEST_CASE(allocate_in_more_iterations)
             check_time--;
         }
     }
-}
\ No newline at end of file
+}
+
+/// Chunks tile the heap, boundary tags match and no two free chunks are adjacent.
+static bool are_chunks_consistent(const inblock_allocator_heap &heap)
+{
+    const chunk_t *prev = nullptr;
+    auto chunk = reinterpret_cast<const chunk_t *>(heap.get_start_addr());
+    while (reinterpret_cast<address_t>(chunk) < heap.get_end_addr()) {
+        if (prev && (get_prev_payload_size(chunk) != get_payload_size(prev) || get_prev_chunk(chunk) != prev)) {
+            return false;
+        }
+        if (prev && !is_used(prev) && !is_used(chunk)) {
+            return false;
+        }
+        prev = chunk;
+        chunk = get_next_chunk(chunk);
+    }
+    return reinterpret_cast<address_t>(chunk) == heap.get_end_addr();
+}
+
+BOOST_AUTO_TEST_CASE(dealloc_middle_chunk_links_neighbours)
+{
+    init_heap(10 * 1024);
+    inblock_allocator<int, holder> allocator;
+
+    int *first = allocator.allocate(10);
+    int *middle = allocator.allocate(10);
+    int *last = allocator.allocate(10);
+    allocator.deallocate(middle, 10);
+
+    const chunk_t *first_chunk = get_chunk_from_payload_addr(reinterpret_cast<address_t>(first));
+    const chunk_t *freed_chunk = get_next_chunk(first_chunk);
+    const chunk_t *last_chunk = get_chunk_from_payload_addr(reinterpret_cast<address_t>(last));
+    BOOST_TEST(!is_used(freed_chunk));
+    BOOST_TEST(get_next_chunk(freed_chunk) == last_chunk);
+    BOOST_TEST(get_prev_chunk(last_chunk) == freed_chunk);
+    BOOST_TEST(are_chunks_consistent(holder::heap));
+
+    // Freed gap is reused by the next allocation of the same size.
+    BOOST_TEST(allocator.allocate(10) == middle);
+}
+
+BOOST_AUTO_TEST_CASE(dealloc_in_random_order_keeps_list_consistent)
+{
+    init_heap(512 * 1024);
+    inblock_allocator<uint8_t, holder> allocator;
+
+    std::vector<std::pair<uint8_t *, size_t>> allocated_data;
+    for (size_t i = 0; i < 2000; i++) {
+        size_t data_size = 1 + rand() % 100;
+        allocated_data.emplace_back(allocator.allocate(data_size), data_size);
+    }
+
+    std::shuffle(allocated_data.begin(), allocated_data.end(), std::mt19937{42});
+    for (size_t i = 0; i < allocated_data.size(); i++) {
+        allocator.deallocate(allocated_data[i].first, allocated_data[i].second);
+        if (i % 100 == 0) {
+            BOOST_TEST_REQUIRE(are_chunks_consistent(holder::heap));
+        }
+    }
+    auto stats = get_allocator_stats(allocator);
+    BOOST_TEST(stats.used_chunks == 0);
+}
+
+struct other_holder {
+    static inblock_allocator_heap heap;
+};
+
+inblock_allocator_heap other_holder::heap;
+
+BOOST_AUTO_TEST_CASE(holders_have_separate_heaps)
+{
+    init_heap(10 * 1024);
+    std::vector<uint8_t> other_mem(10 * 1024);
+    other_holder::heap(other_mem.data(), other_mem.size());
+
+    inblock_allocator<int, holder> allocator;
+    inblock_allocator<int, other_holder> other_allocator;
+
+    int *data = allocator.allocate(10);
+    int *other_data = other_allocator.allocate(20);
+    BOOST_TEST((reinterpret_cast<address_t>(data) >= holder::heap.get_start_addr() &&
+                reinterpret_cast<address_t>(data) < holder::heap.get_end_addr()));
+    BOOST_TEST((reinterpret_cast<address_t>(other_data) >= other_holder::heap.get_start_addr() &&
+                reinterpret_cast<address_t>(other_data) < other_holder::heap.get_end_addr()));
+
+    auto stats = get_allocator_stats(allocator);
+    auto other_stats = get_allocator_stats(other_allocator);
+    BOOST_TEST(stats.used_chunks == 1);
+    BOOST_TEST(other_stats.used_chunks == 1);
+    BOOST_TEST(stats.used_mem_size != other_stats.used_mem_size);
+
+    other_allocator.deallocate(other_data, 20);
+    BOOST_TEST(get_allocator_stats(other_allocator).used_chunks == 0);
+    BOOST_TEST(get_allocator_stats(allocator).used_chunks == 1);
+}
+
+BOOST_AUTO_TEST_CASE(local_heap_instance)
+{
+    std::vector<uint8_t> mem(4 * 1024);
+    inblock_allocator_heap heap;
+    heap(mem.data(), mem.size(), allocation_strategy::chunk_list);
+
+    void *data = heap.allocate(64);
+    BOOST_TEST(data);
+    BOOST_TEST(heap.get_stats().used_blocks == 1);
+    heap.deallocate(data, 64);
+    BOOST_TEST(heap.get_stats().used_blocks == 0);
+}
+
+/* ===================================================================================================== */
+/* ============================== TLSF TESTS ===================================================== */
+/* ===================================================================================================== */
+
+static void init_tlsf_heap(size_t mem_size)
+{
+    auto [start_addr, end_addr] = get_aligned_memory_region(mem_size);
+    fill_memory_region_with_random_data(start_addr, end_addr);
+    size_t num_bytes = diff(start_addr, end_addr);
+    holder::heap((void *)start_addr, num_bytes, allocation_strategy::tlsf);
+}
+
+static size_t count_tlsf_blocks(bool used)
+{
+    size_t count = 0;
+    holder::heap.get_tlsf_pool().for_each_block([&](void *, size_t, bool block_used) {
+        if (block_used == used) {
+            count++;
+        }
+    });
+    return count;
+}
+
+BOOST_AUTO_TEST_CASE(tlsf_allocated_data_are_aligned_test)
+{
+    init_tlsf_heap(32 * 1024);
+    inblock_allocator<uint8_t, holder> allocator;
+
+    for (size_t payload_size = 1; payload_size < 300; payload_size += 7) {
+        uint8_t *data = allocator.allocate(payload_size);
+        BOOST_TEST(data);
+        BOOST_TEST(is_aligned((intptr_t)data));
+    }
+    BOOST_TEST(holder::heap.get_tlsf_pool().check());
+}
+
+BOOST_AUTO_TEST_CASE(tlsf_frees_coalesce_into_one_block_test)
+{
+    init_tlsf_heap(256 * 1024);
+    inblock_allocator<uint8_t, holder> allocator;
+
+    std::vector<std::pair<uint8_t *, size_t>> allocated_data;
+    for (size_t i = 0; i < 500; i++) {
+        size_t data_size = 1 + rand() % 300;
+        allocated_data.emplace_back(allocator.allocate(data_size), data_size);
+    }
+    BOOST_TEST(count_tlsf_blocks(true) == allocated_data.size());
+
+    std::shuffle(allocated_data.begin(), allocated_data.end(), std::mt19937{42});
+    for (auto &&allocated_item : allocated_data) {
+        allocator.deallocate(allocated_item.first, allocated_item.second);
+        BOOST_TEST_REQUIRE(holder::heap.get_tlsf_pool().check());
+    }
+    BOOST_TEST(count_tlsf_blocks(true) == 0);
+    BOOST_TEST(count_tlsf_blocks(false) == 1);
+}
+
+BOOST_AUTO_TEST_CASE(tlsf_payloads_consistency_test)
+{
+    init_tlsf_heap(256 * 1024);
+    inblock_allocator<uint8_t, holder> allocator;
+
+    std::vector<std::pair<uint8_t *, size_t>> allocated_data;
+    for (size_t i = 0; i < 2000; i++) {
+        if (!allocated_data.empty() && rand() % 3 == 0) {
+            size_t idx = rand() % allocated_data.size();
+            BOOST_TEST(check_payload_consistency(allocated_data[idx].first, allocated_data[idx].second));
+            allocator.deallocate(allocated_data[idx].first, allocated_data[idx].second);
+            allocated_data.erase(allocated_data.begin() + idx);
+        }
+        else {
+            size_t data_size = 1 + rand() % 500;
+            uint8_t *data = allocator.allocate(data_size);
+            fill_payload(data, data_size);
+            allocated_data.emplace_back(data, data_size);
+        }
+    }
+    for (auto &&allocated_item : allocated_data) {
+        BOOST_TEST(check_payload_consistency(allocated_item.first, allocated_item.second));
+    }
+    BOOST_TEST(holder::heap.get_tlsf_pool().check());
+}
+
+BOOST_AUTO_TEST_CASE(tlsf_run_out_of_memory_test)
+{
+    init_tlsf_heap(16 * 1024);
+    inblock_allocator<uint8_t, holder> allocator;
+
+    BOOST_CHECK_THROW(allocator.allocate(64 * 1024), allocator_exception);
+    uint8_t *data = allocator.allocate(1024);
+    BOOST_TEST(data);
+    BOOST_TEST(holder::heap.get_tlsf_pool().check());
+}
+
+BOOST_AUTO_TEST_CASE(tlsf_pool_at_block_size_limit_test)
+{
+    // Only the pages holding the headers get touched, the rest stays unbacked.
+    const size_t region_size = tlsf_pool::block_size_max + tlsf_pool::get_pool_overhead() + 64 * 1024;
+    void *region = mmap(nullptr, region_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    BOOST_TEST_REQUIRE(region != MAP_FAILED);
+    auto start_addr = reinterpret_cast<address_t>(region);
+
+    for (size_t extra : {size_t{0}, alignment, 2 * alignment, size_t{64 * 1024}}) {
+        tlsf_pool pool;
+        pool.initialize(start_addr, start_addr + tlsf_pool::block_size_max + tlsf_pool::get_pool_overhead() + extra -
+                                    alignment);
+        BOOST_TEST_REQUIRE(pool.check());
+
+        void *small = pool.allocate(64);
+        void *big = pool.allocate(tlsf_pool::block_size_max / 2);
+        BOOST_TEST(small);
+        BOOST_TEST(big);
+        BOOST_TEST(pool.check());
+        pool.deallocate(big);
+        pool.deallocate(small);
+        BOOST_TEST(pool.check());
+    }
+    munmap(region, region_size);
+}
+
+/* ===================================================================================================== */
+/* ============================== THREAD-SAFE HEAP TESTS ===================================================== */
+/* ===================================================================================================== */
+
+static void alloc_free_in_thread(unsigned seed)
+{
+    inblock_allocator<uint8_t, holder> allocator;
+    std::mt19937 rng{seed};
+    std::vector<std::pair<uint8_t *, size_t>> allocated_data;
+
+    for (size_t i = 0; i < 20000; i++) {
+        if (!allocated_data.empty() && rng() % 2 == 0) {
+            size_t idx = rng() % allocated_data.size();
+            if (!check_payload_consistency(allocated_data[idx].first, allocated_data[idx].second)) {
+                throw std::runtime_error{"Payload overwritten by other thread"};
+            }
+            allocator.deallocate(allocated_data[idx].first, allocated_data[idx].second);
+            allocated_data[idx] = allocated_data.back();
+            allocated_data.pop_back();
+        }
+        else {
+            size_t data_size = 1 + rng() % 600;
+            uint8_t *data = allocator.allocate(data_size);
+            fill_payload(data, data_size);
+            allocated_data.emplace_back(data, data_size);
+        }
+    }
+
+    for (auto &&allocated_item : allocated_data) {
+        allocator.deallocate(allocated_item.first, allocated_item.second);
+    }
+}
+
+static void run_threads_on_heap(allocation_strategy strategy)
+{
+    auto [start_addr, end_addr] = get_aligned_memory_region(4 * 1024 * 1024);
+    holder::heap.set_thread_safe(true);
+    holder::heap((void *)start_addr, diff(start_addr, end_addr), strategy);
+
+    std::vector<std::thread> threads;
+    std::vector<std::exception_ptr> errors(4);
+    for (unsigned i = 0; i < 4; i++) {
+        threads.emplace_back([i, &errors]() {
+            try {
+                alloc_free_in_thread(i + 1);
+            }
+            catch (...) {
+                errors[i] = std::current_exception();
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    holder::heap.set_thread_safe(false);
+
+    for (auto &error : errors) {
+        BOOST_TEST(!error);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(thread_safe_chunk_list_heap_test)
+{
+    run_threads_on_heap(allocation_strategy::chunk_list);
+
+    // Exited threads returned their caches.
+    auto stats = get_allocator_stats(inblock_allocator<uint8_t, holder>{});
+    BOOST_TEST(stats.used_chunks == 0);
+}
+
+BOOST_AUTO_TEST_CASE(thread_safe_tlsf_heap_test)
+{
+    run_threads_on_heap(allocation_strategy::tlsf);
+
+    BOOST_TEST(holder::heap.get_tlsf_pool().check());
+    BOOST_TEST(count_tlsf_blocks(true) == 0);
+}
+
+/* ===================================================================================================== */
+/* ============================== MONOTONIC HEAP TESTS ===================================================== */
+/* ===================================================================================================== */
+
+static void init_monotonic_heap(size_t mem_size)
+{
+    auto [start_addr, end_addr] = get_aligned_memory_region(mem_size);
+    holder::heap((void *)start_addr, diff(start_addr, end_addr), allocation_strategy::monotonic);
+}
+
+BOOST_AUTO_TEST_CASE(monotonic_allocations_are_consecutive)
+{
+    init_monotonic_heap(4 * 1024);
+    inblock_allocator<uint8_t, holder> allocator;
+
+    uint8_t *first = allocator.allocate(13);
+    uint8_t *second = allocator.allocate(8);
+    BOOST_TEST(is_aligned((intptr_t)first));
+    BOOST_TEST(is_aligned((intptr_t)second));
+    BOOST_TEST(second == first + align_size_up(13));
+
+    // Deallocation does not give the memory back.
+    allocator.deallocate(second, 8);
+    BOOST_TEST(allocator.allocate(8) == second + 8);
+}
+
+BOOST_AUTO_TEST_CASE(monotonic_reset_releases_everything)
+{
+    init_monotonic_heap(4 * 1024);
+    inblock_allocator<uint8_t, holder> allocator;
+
+    uint8_t *first = allocator.allocate(1024);
+    allocator.allocate(2048);
+    BOOST_CHECK_THROW(allocator.allocate(2048), allocator_exception);
+
+    holder::heap.reset();
+    BOOST_TEST(allocator.allocate(1024) == first);
+}
+
+BOOST_AUTO_TEST_CASE(monotonic_nested_arena_scopes)
+{
+    init_monotonic_heap(4 * 1024);
+    inblock_allocator<uint8_t, holder> allocator;
+
+    uint8_t *outer_data = allocator.allocate(16);
+    uint8_t *after_outer = nullptr;
+    {
+        arena_scope outer{holder::heap};
+        after_outer = allocator.allocate(16);
+        {
+            arena_scope inner{holder::heap};
+            allocator.allocate(512);
+        }
+        BOOST_TEST(allocator.allocate(16) == after_outer + 16);
+    }
+    BOOST_TEST(allocator.allocate(16) == after_outer);
+    BOOST_TEST(outer_data + 16 == after_outer);
+}
+
+BOOST_AUTO_TEST_CASE(monotonic_vector_in_arena_scope)
+{
+    init_monotonic_heap(1024 * 1024);
+    heap_marker_t marker = holder::heap.get_marker();
+    {
+        arena_scope scope{holder::heap};
+        Vector<int> vec;
+        for (int i = 0; i < 1000; i++) {
+            vec.push_back(i);
+        }
+        BOOST_TEST(vec[999] == 999);
+    }
+    BOOST_TEST(holder::heap.get_marker().position == marker.position);
+}
+
+BOOST_AUTO_TEST_CASE(monotonic_stats_after_arena_scope)
+{
+    init_monotonic_heap(64 * 1024);
+    holder::heap.set_stats_enabled(true);
+    inblock_allocator<uint8_t, holder> allocator;
+    allocator.allocate(16);
+    {
+        arena_scope scope{holder::heap};
+        allocator.allocate(100);
+        inblock_allocator<uint64_t, holder>{}.allocate(3);
+        BOOST_TEST(holder::heap.get_stats().used_blocks == 3);
+    }
+    heap_stats_t stats = holder::heap.get_stats();
+    BOOST_TEST(stats.used_blocks == 1);
+    BOOST_TEST(stats.counters.live_blocks == 1);
+    BOOST_TEST(stats.counters.live_bytes == 16);
+    holder::heap.set_stats_enabled(false);
+}
+
+/* ===================================================================================================== */
+/* ============================== SLAB POOL TESTS ===================================================== */
+/* ===================================================================================================== */
+
+struct small_object_t {
+    uint64_t a;
+    uint64_t b;
+    uint32_t c;
+};
+
+static void init_slab_heap(size_t mem_size, allocation_strategy strategy)
+{
+    auto [start_addr, end_addr] = get_aligned_memory_region(mem_size);
+    fill_memory_region_with_random_data(start_addr, end_addr);
+    holder::heap.set_slab_pools(true);
+    holder::heap((void *)start_addr, diff(start_addr, end_addr), strategy);
+}
+
+BOOST_DATA_TEST_CASE(slab_single_objects_share_slab, boost::unit_test::data::make(freeing_strategies), strategy)
+{
+    init_slab_heap(64 * 1024, strategy);
+    inblock_allocator<small_object_t, holder> allocator;
+
+    small_object_t *first = allocator.allocate(1);
+    small_object_t *second = allocator.allocate(1);
+    // No header between the slots.
+    BOOST_TEST(reinterpret_cast<address_t>(second) - reinterpret_cast<address_t>(first) == sizeof(small_object_t));
+    BOOST_TEST((reinterpret_cast<address_t>(first) & ~(slab_pool::slab_size - 1)) ==
+               (reinterpret_cast<address_t>(second) & ~(slab_pool::slab_size - 1)));
+
+    // Freed slot is reused first.
+    allocator.deallocate(first, 1);
+    BOOST_TEST(allocator.allocate(1) == first);
+
+    // Arrays do not go to slabs.
+    small_object_t *array = allocator.allocate(2);
+    address_t slab_start = reinterpret_cast<address_t>(first) & ~(slab_pool::slab_size - 1);
+    address_t array_addr = reinterpret_cast<address_t>(array);
+    BOOST_TEST((array_addr < slab_start || array_addr >= slab_start + slab_pool::slab_block_size));
+    allocator.deallocate(array, 2);
+    holder::heap.set_slab_pools(false);
+}
+
+BOOST_AUTO_TEST_CASE(slab_empty_slabs_are_returned)
+{
+    init_slab_heap(1024 * 1024, allocation_strategy::chunk_list);
+    inblock_allocator<uint64_t, holder> allocator;
+
+    std::vector<uint64_t *> objects;
+    for (size_t i = 0; i < 5000; i++) {
+        uint64_t *object = allocator.allocate(1);
+        *object = i;
+        objects.push_back(object);
+    }
+    size_t chunks_with_slabs = get_allocator_stats(allocator).used_chunks;
+    BOOST_TEST(chunks_with_slabs == (5000 + 498) / 499); // 499 slots of 8 bytes per slab
+
+    std::shuffle(objects.begin(), objects.end(), std::mt19937{42});
+    for (uint64_t *object : objects) {
+        allocator.deallocate(object, 1);
+    }
+    // Only the last slab of the class is kept.
+    BOOST_TEST(get_allocator_stats(allocator).used_chunks == 1);
+    holder::heap.set_slab_pools(false);
+}
+
+BOOST_AUTO_TEST_CASE(slab_objects_consistency_test)
+{
+    init_slab_heap(1024 * 1024, allocation_strategy::tlsf);
+    inblock_allocator<small_object_t, holder> allocator;
+
+    std::vector<small_object_t *> objects;
+    for (uint64_t i = 0; i < 20000; i++) {
+        if (!objects.empty() && rand() % 3 == 0) {
+            size_t idx = rand() % objects.size();
+            BOOST_TEST(objects[idx]->a == objects[idx]->b);
+            allocator.deallocate(objects[idx], 1);
+            objects[idx] = objects.back();
+            objects.pop_back();
+        }
+        else {
+            small_object_t *object = allocator.allocate(1);
+            *object = {i, i, 0};
+            objects.push_back(object);
+        }
+    }
+    for (small_object_t *object : objects) {
+        BOOST_TEST(object->a == object->b);
+        allocator.deallocate(object, 1);
+    }
+    BOOST_TEST(holder::heap.get_tlsf_pool().check());
+    holder::heap.set_slab_pools(false);
+}
+
+BOOST_AUTO_TEST_CASE(aligned_blocks_leave_usable_gaps)
+{
+    init_heap(64 * 1024);
+    holder::heap.set_slab_pools(true);
+    inblock_allocator<uint64_t, holder> allocator;
+    inblock_allocator<uint8_t, holder> byte_allocator;
+
+    // Slab is placed on the next slab boundary, the gap in front of it stays usable.
+    uint8_t *before = byte_allocator.allocate(16);
+    uint64_t *object = allocator.allocate(1);
+    uint8_t *after = byte_allocator.allocate(16);
+    BOOST_TEST(after < reinterpret_cast<uint8_t *>(object));
+    BOOST_TEST(before < after);
+    holder::heap.set_slab_pools(false);
+}
+
+BOOST_AUTO_TEST_CASE(sized_slots_hold_small_arrays)
+{
+    init_slab_heap(64 * 1024, allocation_strategy::chunk_list);
+    holder::heap.set_sized_slots(true);
+    inblock_allocator<uint32_t, holder> allocator;
+
+    // 12 and 16 bytes share the size class of 16 bytes, no header between the slots.
+    uint32_t *first = allocator.allocate(3);
+    uint32_t *second = allocator.allocate(4);
+    BOOST_TEST(reinterpret_cast<address_t>(second) - reinterpret_cast<address_t>(first) == 16);
+    auto [third, count] = allocator.allocate_at_least(3);
+    BOOST_TEST(count == 4);
+    BOOST_TEST(third == second + 4);
+
+    // Arrays over the biggest slot get blocks.
+    uint32_t *array = allocator.allocate(slab_pool::max_slot_size / sizeof(uint32_t) + 1);
+    address_t slab_start = reinterpret_cast<address_t>(first) & ~(slab_pool::slab_size - 1);
+    address_t array_addr = reinterpret_cast<address_t>(array);
+    BOOST_TEST((array_addr < slab_start || array_addr >= slab_start + slab_pool::slab_block_size));
+
+    allocator.deallocate(array, slab_pool::max_slot_size / sizeof(uint32_t) + 1);
+    allocator.deallocate(third, count);
+    allocator.deallocate(second, 4);
+    allocator.deallocate(first, 3);
+    // Only the last slab of the class is kept.
+    BOOST_TEST(holder::heap.get_stats().used_blocks == 1);
+    holder::heap.set_sized_slots(false);
+    holder::heap.set_slab_pools(false);
+}
+
+BOOST_AUTO_TEST_CASE(sized_slots_consistency_test)
+{
+    init_slab_heap(1024 * 1024, allocation_strategy::tlsf);
+    holder::heap.set_sized_slots(true);
+    inblock_allocator<uint64_t, holder> allocator;
+
+    // Counts up to 24 cross the biggest slot of 16 objects, so slots and blocks mix.
+    std::vector<std::pair<uint64_t *, size_t>> arrays;
+    std::mt19937 rng{42};
+    for (uint64_t i = 0; i < 20000; i++) {
+        if (!arrays.empty() && rng() % 3 == 0) {
+            auto &[array, n] = arrays[rng() % arrays.size()];
+            BOOST_TEST(std::all_of(array, array + n, [&](uint64_t value) { return value == array[0]; }));
+            allocator.deallocate(array, n);
+            std::swap(array, arrays.back().first);
+            std::swap(n, arrays.back().second);
+            arrays.pop_back();
+        }
+        else {
+            size_t n = 1 + rng() % 24;
+            uint64_t *array = allocator.allocate(n);
+            std::fill(array, array + n, i);
+            arrays.emplace_back(array, n);
+        }
+    }
+    for (auto [array, n] : arrays) {
+        BOOST_TEST(std::all_of(array, array + n, [&](uint64_t value) { return value == array[0]; }));
+        allocator.deallocate(array, n);
+    }
+    BOOST_TEST(holder::heap.get_tlsf_pool().check());
+    BOOST_TEST(holder::heap.get_stats().used_blocks <= slab_pool::size_class_count);
+    holder::heap.set_sized_slots(false);
+    holder::heap.set_slab_pools(false);
+}
+
+/* ===================================================================================================== */
+/* ============================== IN-PLACE RESIZE TESTS ===================================================== */
+/* ===================================================================================================== */
+
+/// Every block was freed and merged back into a single free one.
+static void check_heap_is_empty(allocation_strategy strategy)
+{
+    if (strategy == allocation_strategy::tlsf) {
+        BOOST_TEST(holder::heap.get_tlsf_pool().check());
+        BOOST_TEST(count_tlsf_blocks(true) == 0);
+        BOOST_TEST(count_tlsf_blocks(false) == 1);
+    }
+    else {
+        BOOST_TEST(holder::heap.get_stats().used_blocks == 0);
+        BOOST_TEST(are_chunks_consistent(holder::heap));
+    }
+}
+
+BOOST_DATA_TEST_CASE(expand_into_free_space, boost::unit_test::data::make(freeing_strategies), strategy)
+{
+    init_heap(64 * 1024, strategy);
+    inblock_allocator<uint64_t, holder> allocator;
+
+    uint64_t *first = allocator.allocate(4);
+    uint64_t *second = allocator.allocate(4);
+    uint64_t *third = allocator.allocate(4);
+    fill_payload(second, 4 * sizeof(uint64_t));
+
+    // Next block is used.
+    BOOST_TEST(!allocator.try_expand(first, 4, 8));
+
+    // Freed neighbour is taken over.
+    allocator.deallocate(third, 4);
+    BOOST_TEST(allocator.try_expand(second, 4, 64));
+    BOOST_TEST(check_payload_consistency(second, 4 * sizeof(uint64_t)));
+
+    // The rest of the heap is free after a shrink again.
+    BOOST_TEST(allocator.try_shrink(second, 64, 2));
+    uint64_t *fourth = allocator.allocate(4);
+    BOOST_TEST(fourth < second + 64);
+
+    allocator.deallocate(fourth, 4);
+    allocator.deallocate(second, 2);
+    allocator.deallocate(first, 4);
+    check_heap_is_empty(strategy);
+}
+
+BOOST_AUTO_TEST_CASE(monotonic_expand_last_block_only)
+{
+    init_monotonic_heap(4 * 1024);
+    inblock_allocator<uint64_t, holder> allocator;
+
+    uint64_t *first = allocator.allocate(4);
+    uint64_t *second = allocator.allocate(4);
+    BOOST_TEST(!allocator.try_expand(first, 4, 8));
+    BOOST_TEST(allocator.try_expand(second, 4, 8));
+    BOOST_TEST(allocator.allocate(1) == second + 8);
+    BOOST_TEST(!allocator.try_expand(second, 8, 1024));
+}
+
+BOOST_AUTO_TEST_CASE(tlsf_allocate_at_least_reports_usable_size)
+{
+    init_tlsf_heap(64 * 1024);
+    inblock_allocator<uint8_t, holder> allocator;
+
+    auto [ptr, count] = allocator.allocate_at_least(3);
+    BOOST_TEST(count >= 3);
+    BOOST_TEST(count == tlsf_pool::get_usable_size(ptr));
+    allocator.deallocate(ptr, count);
+    BOOST_TEST(count_tlsf_blocks(true) == 0);
+}
+
+BOOST_DATA_TEST_CASE(allocate_at_least_count_frees_the_block,
+                     boost::unit_test::data::make(freeing_strategies) +
+                     boost::unit_test::data::make(allocation_strategy::monotonic),
+                     strategy)
+{
+    // Monotonic heap does not grow, the others run out of their memory soon.
+    init_heap(strategy == allocation_strategy::monotonic ? 1024 * 1024 : 16 * 1024, strategy);
+    holder::heap.set_growable(true);
+    holder::heap.set_direct_map_threshold(4096);
+    inblock_allocator<uint8_t, holder> allocator;
+
+    // Freed neighbours merge into gaps around the threshold, in the heap and in mapped regions.
+    std::vector<std::pair<uint8_t *, size_t>> blocks;
+    std::vector<std::pair<uint8_t *, size_t>> gaps;
+    for (size_t size = 1984; size <= 2112; size += 8) {
+        gaps.emplace_back(allocator.allocate(size), size);
+        gaps.emplace_back(allocator.allocate(size), size);
+        blocks.emplace_back(allocator.allocate(size), size);
+        fill_payload(blocks.back().first, size);
+    }
+    for (auto [ptr, size] : gaps) {
+        allocator.deallocate(ptr, size);
+    }
+
+    // Requests just below the threshold take whole gaps that reach it, splits would leave too little.
+    constexpr size_t size = 4096 - alignment;
+    for (size_t i = 0; i < gaps.size() / 2; i++) {
+        auto [ptr, count] = allocator.allocate_at_least(size);
+        BOOST_TEST(count >= size);
+        fill_payload(ptr, count);
+        blocks.emplace_back(ptr, count);
+    }
+    for (auto [ptr, count] : blocks) {
+        BOOST_TEST(check_payload_consistency(ptr, count));
+        allocator.deallocate(ptr, count);
+    }
+    BOOST_TEST(holder::heap.get_direct_mappings().get_count() == 0);
+    BOOST_TEST(holder::heap.get_stats().used_blocks == 0);
+    holder::heap.release_empty_regions();
+    holder::heap.set_direct_map_threshold(0);
+    holder::heap.set_growable(false);
+}
+
+BOOST_DATA_TEST_CASE(inblock_vector_grows_in_place, boost::unit_test::data::make(freeing_strategies), strategy)
+{
+    init_heap(256 * 1024, strategy);
+    inblock_vector<uint32_t, holder> vector;
+    vector.push_back(0);
+    const uint32_t *data = vector.data();
+    for (uint32_t i = 1; i < 10000; i++) {
+        vector.push_back(i);
+    }
+    // Nothing else lives on the heap, so the buffer never had to move.
+    BOOST_TEST(vector.data() == data);
+    for (uint32_t i = 0; i < 10000; i++) {
+        BOOST_TEST(vector[i] == i);
+    }
+
+    vector.resize(10);
+    vector.shrink_to_fit();
+    BOOST_TEST(vector.capacity() == 10);
+}
+
+BOOST_AUTO_TEST_CASE(inblock_vector_moves_when_blocked)
+{
+    init_heap(64 * 1024);
+    inblock_vector<uint64_t, holder> first;
+    inblock_vector<uint64_t, holder> second;
+    for (uint64_t i = 0; i < 1000; i++) {
+        first.push_back(i);
+        second.push_back(i);
+    }
+    for (uint64_t i = 0; i < 1000; i++) {
+        BOOST_TEST(first[i] == i);
+        BOOST_TEST(second[i] == i);
+    }
+
+    inblock_vector<uint64_t, holder> copy = first;
+    first.clear();
+    first.shrink_to_fit();
+    BOOST_TEST(copy.size() == 1000);
+    BOOST_TEST(copy.back() == 999);
+}
+
+BOOST_AUTO_TEST_CASE(inblock_vector_push_back_own_element)
+{
+    init_heap(64 * 1024);
+    inblock_vector<std::string, holder> vector;
+    inblock_vector<std::string, holder> blocker;
+    for (size_t i = 0; i < 100; i++) {
+        vector.push_back(std::string(40, static_cast<char>('a' + i % 26)));
+        blocker.push_back("blocker");
+        // Appending an element of the vector itself must survive the relocation.
+        vector.push_back(vector.back());
+        BOOST_TEST(vector.back() == std::string(40, static_cast<char>('a' + i % 26)));
+    }
+    BOOST_TEST(vector.size() == 200);
+}
+
+namespace {
+struct throwing_copy {
+    static inline size_t live = 0;
+    static inline size_t copies_left = 0;
+    uint64_t value;
+
+    explicit throwing_copy(uint64_t value)
+        : value{value}
+    {
+        live++;
+    }
+
+    throwing_copy(const throwing_copy &other)
+        : value{other.value}
+    {
+        if (copies_left == 0) {
+            throw std::runtime_error{"copy failed"};
+        }
+        copies_left--;
+        live++;
+    }
+
+    ~throwing_copy()
+    {
+        live--;
+    }
+};
+}
+
+BOOST_AUTO_TEST_CASE(inblock_vector_relocation_is_exception_safe)
+{
+    init_heap(64 * 1024);
+    {
+        inblock_vector<throwing_copy, holder> vector;
+        inblock_vector<uint64_t, holder> blocker;
+        throwing_copy::copies_left = 0;
+        vector.reserve(8);
+        for (uint64_t i = 0; i < 8; i++) {
+            vector.emplace_back(i);
+        }
+        blocker.push_back(0);
+
+        // Relocation fails halfway through the copies.
+        throwing_copy::copies_left = 4;
+        BOOST_CHECK_THROW(vector.emplace_back(8), std::runtime_error);
+        BOOST_TEST(vector.size() == 8);
+        BOOST_TEST(throwing_copy::live == 8);
+        for (uint64_t i = 0; i < 8; i++) {
+            BOOST_TEST(vector[i].value == i);
+        }
+
+        throwing_copy::copies_left = 4;
+        BOOST_CHECK_THROW(vector.reserve(64), std::runtime_error);
+        BOOST_TEST(vector.size() == 8);
+        BOOST_TEST(throwing_copy::live == 8);
+    }
+    BOOST_TEST(throwing_copy::live == 0);
+    // Every buffer allocated during the failed relocations was given back.
+    BOOST_TEST(get_allocator_stats(inblock_allocator<uint8_t, holder>{}).used_chunks == 0);
+}
+
+/* ===================================================================================================== */
+/* ============================== HEAP STATS TESTS ===================================================== */
+/* ===================================================================================================== */
+
+BOOST_DATA_TEST_CASE(stats_follow_allocations, boost::unit_test::data::make(freeing_strategies), strategy)
+{
+    init_heap(64 * 1024, strategy);
+    holder::heap.set_stats_enabled(true);
+    holder::heap.reset_stats();
+    inblock_allocator<uint64_t, holder> allocator;
+
+    uint64_t *first = allocator.allocate(8);
+    uint64_t *second = allocator.allocate(8);
+    uint64_t *third = allocator.allocate(8);
+    heap_stats_t stats = holder::heap.get_stats();
+    BOOST_TEST(stats.counters.live_blocks == 3);
+    BOOST_TEST(stats.counters.live_bytes >= 3 * 64);
+    BOOST_TEST(stats.used_blocks == 3);
+    BOOST_TEST(stats.counters.allocation_sizes.buckets[7] == 3); // 64 bytes
+
+    allocator.deallocate(second, 8);
+    stats = holder::heap.get_stats();
+    BOOST_TEST(stats.counters.live_blocks == 2);
+    BOOST_TEST(stats.counters.peak_bytes > stats.counters.live_bytes);
+    BOOST_TEST(stats.used_blocks == 2);
+    // The hole after the middle block is much smaller than the rest of the heap.
+    BOOST_TEST(stats.get_fragmentation() > 0.0);
+    BOOST_TEST(stats.get_fragmentation() < 0.01);
+    BOOST_TEST(stats.largest_free_gap < stats.free_bytes);
+
+    allocator.deallocate(first, 8);
+    allocator.deallocate(third, 8);
+    stats = holder::heap.get_stats();
+    BOOST_TEST(stats.counters.live_bytes == 0);
+    BOOST_TEST(stats.counters.deallocations == 3);
+    BOOST_TEST(stats.get_fragmentation() == 0.0);
+    holder::heap.set_stats_enabled(false);
+}
+
+BOOST_AUTO_TEST_CASE(stats_record_walk_lengths)
+{
+    init_heap(64 * 1024);
+    holder::heap.set_stats_enabled(true);
+    holder::heap.reset_stats();
+    inblock_allocator<uint64_t, holder> allocator;
+
+    for (size_t i = 0; i < 20; i++) {
+        allocator.allocate(1);
+    }
+    const log2_histogram_t &walks = holder::heap.get_stats().counters.walk_lengths;
+    BOOST_TEST(walks.get_total() == 20);
+    // Allocation k walks past k - 1 used chunks, walks of 16 to 19 chunks fall into bucket 5.
+    BOOST_TEST(walks.buckets[5] == 4);
+    holder::heap.set_stats_enabled(false);
+}
+
+BOOST_AUTO_TEST_CASE(stats_are_off_by_default)
+{
+    init_heap(4 * 1024);
+    holder::heap.reset_stats();
+    inblock_allocator<uint64_t, holder> allocator;
+    allocator.allocate(4);
+    BOOST_TEST(holder::heap.get_stats().counters.allocations == 0);
+    BOOST_TEST(holder::heap.get_stats().used_blocks == 1);
+}
+
+BOOST_AUTO_TEST_CASE(stats_dump_as_json)
+{
+    init_heap(4 * 1024);
+    std::ostringstream out;
+    write_json(out, holder::heap.get_stats());
+    std::string json = out.str();
+    BOOST_TEST(json.front() == '{');
+    BOOST_TEST(json.back() == '}');
+    BOOST_TEST(json.find("\"largest_free_gap\": ") != std::string::npos);
+    BOOST_TEST(json.find("\"walk_lengths_log2\": [") != std::string::npos);
+}
+
+/* ===================================================================================================== */
+/* ============================== TRACE TESTS ===================================================== */
+/* ===================================================================================================== */
+
+BOOST_AUTO_TEST_CASE(trace_records_allocator_operations)
+{
+    init_heap(64 * 1024);
+    const std::string path = "unit_tests_trace.bin";
+    {
+        trace_recorder recorder{path};
+        holder::heap.set_trace_recorder(&recorder);
+        inblock_allocator<uint32_t, holder> allocator;
+
+        uint32_t *first = allocator.allocate(4);
+        uint32_t *second = allocator.allocate(2);
+        allocator.deallocate(first, 4);
+        BOOST_TEST(allocator.try_expand(second, 2, 8));
+        allocator.deallocate(second, 8);
+        holder::heap.set_trace_recorder(nullptr);
+
+        // Not recorded any more.
+        allocator.deallocate(allocator.allocate(1), 1);
+    }
+
+    std::vector<trace_record_t> trace = read_trace(path);
+    std::remove(path.c_str());
+    BOOST_TEST(trace.size() == 5);
+    BOOST_TEST((trace[0].op == trace_op::allocate && trace[0].id == 0 && trace[0].size == 16));
+    BOOST_TEST((trace[1].op == trace_op::allocate && trace[1].id == 1 && trace[1].size == 8));
+    BOOST_TEST((trace[2].op == trace_op::deallocate && trace[2].id == 0));
+    BOOST_TEST((trace[3].op == trace_op::resize && trace[3].id == 1 && trace[3].size == 32));
+    BOOST_TEST((trace[4].op == trace_op::deallocate && trace[4].id == 1));
+    BOOST_TEST(trace[0].timestamp <= trace[4].timestamp);
+}
+
+BOOST_AUTO_TEST_CASE(trace_rejects_other_files)
+{
+    const std::string path = "unit_tests_not_trace.bin";
+    std::ofstream{path} << "not a trace";
+    BOOST_CHECK_THROW(read_trace(path), allocator_exception);
+    std::remove(path.c_str());
+}
+
+/* ===================================================================================================== */
+/* ============================== OVER-ALIGNED ALLOCATION TESTS ===================================================== */
+/* ===================================================================================================== */
+
+struct alignas(64) cache_line_t {
+    uint64_t values[3];
+};
+
+BOOST_DATA_TEST_CASE(over_aligned_types,
+                     boost::unit_test::data::make(freeing_strategies) +
+                     boost::unit_test::data::make(allocation_strategy::monotonic),
+                     strategy)
+{
+    init_heap(256 * 1024, strategy);
+    std::vector<cache_line_t, inblock_allocator<cache_line_t, holder>> lines;
+    inblock_allocator<uint8_t, holder> byte_allocator;
+    for (uint64_t i = 0; i < 200; i++) {
+        // Misaligns the end of the used space.
+        byte_allocator.allocate(1 + i % 3);
+        lines.push_back(cache_line_t{{i, i, i}});
+        BOOST_TEST(reinterpret_cast<address_t>(lines.data()) % 64 == 0);
+    }
+    for (uint64_t i = 0; i < 200; i++) {
+        BOOST_TEST(lines[i].values[2] == i);
+    }
+    if (strategy == allocation_strategy::tlsf) {
+        BOOST_TEST(holder::heap.get_tlsf_pool().check());
+    }
+}
+
+BOOST_DATA_TEST_CASE(explicit_alignment_up_to_page, boost::unit_test::data::make(freeing_strategies), strategy)
+{
+    init_heap(256 * 1024, strategy);
+    inblock_allocator<uint8_t, holder> allocator;
+    std::vector<std::pair<uint8_t *, size_t>> blocks;
+    for (size_t align = 1; align <= max_alignment; align *= 2) {
+        uint8_t *small = allocator.allocate(3);
+        uint8_t *aligned = allocator.allocate_aligned(100, align);
+        BOOST_TEST(reinterpret_cast<address_t>(aligned) % align == 0);
+        fill_payload(aligned, 100);
+        blocks.push_back({small, 0});
+        blocks.push_back({aligned, align});
+    }
+    for (auto [ptr, align] : blocks) {
+        if (align == 0) {
+            allocator.deallocate(ptr, 3);
+        }
+        else {
+            BOOST_TEST(check_payload_consistency(ptr, 100));
+            allocator.deallocate_aligned(ptr, 100, align);
+        }
+    }
+    check_heap_is_empty(strategy);
+}
+
+BOOST_AUTO_TEST_CASE(explicit_alignment_skips_thread_cache_and_slabs)
+{
+    init_tlsf_heap(256 * 1024);
+    holder::heap.set_thread_safe(true);
+    holder::heap.set_slab_pools(true);
+    inblock_allocator<uint64_t, holder> allocator;
+    for (int i = 0; i < 100; i++) {
+        uint64_t *ptr = allocator.allocate_aligned(1, 128);
+        BOOST_TEST(reinterpret_cast<address_t>(ptr) % 128 == 0);
+        allocator.deallocate_aligned(ptr, 1, 128);
+    }
+    holder::heap.flush_thread_cache();
+    holder::heap.set_slab_pools(false);
+    holder::heap.set_thread_safe(false);
+    BOOST_TEST(count_tlsf_blocks(true) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(unsupported_alignment_throws)
+{
+    init_heap(16 * 1024);
+    inblock_allocator<uint8_t, holder> allocator;
+    BOOST_CHECK_THROW(allocator.allocate_aligned(1, 24), allocator_exception);
+    BOOST_CHECK_THROW(allocator.allocate_aligned(1, 2 * max_alignment), allocator_exception);
+}
+
+/* ===================================================================================================== */
+/* ============================== GROWABLE HEAP TESTS ===================================================== */
+/* ===================================================================================================== */
+
+BOOST_DATA_TEST_CASE(growable_heap_maps_regions, boost::unit_test::data::make(freeing_strategies), strategy)
+{
+    init_heap(16 * 1024, strategy);
+    holder::heap.set_growable(true);
+    holder::heap.set_stats_enabled(true);
+    holder::heap.reset_stats();
+    inblock_allocator<uint8_t, holder> allocator;
+
+    std::vector<uint8_t *> blocks;
+    for (size_t i = 0; i < 1000; i++) {
+        uint8_t *data = allocator.allocate(1000);
+        fill_payload(data, 1000);
+        blocks.push_back(data);
+    }
+    heap_stats_t stats = holder::heap.get_stats();
+    BOOST_TEST(stats.region_count >= 1);
+    BOOST_TEST(stats.region_bytes >= region_list::min_region_size);
+    BOOST_TEST(stats.used_blocks == blocks.size());
+    BOOST_TEST(holder::heap.get_regions().check());
+
+    for (uint8_t *data : blocks) {
+        BOOST_TEST(check_payload_consistency(data, 1000));
+        allocator.deallocate(data, 1000);
+    }
+    BOOST_TEST(holder::heap.get_stats().counters.live_bytes == 0);
+    BOOST_TEST(holder::heap.get_stats().used_blocks == 0);
+    // The newest region is kept for the next allocations.
+    BOOST_TEST(holder::heap.get_regions().get_count() == 1);
+    BOOST_TEST(holder::heap.release_empty_regions() >= region_list::min_region_size);
+    BOOST_TEST(holder::heap.get_regions().get_count() == 0);
+    holder::heap.set_stats_enabled(false);
+    holder::heap.set_growable(false);
+}
+
+BOOST_AUTO_TEST_CASE(growable_regions_grow_geometrically)
+{
+    init_tlsf_heap(16 * 1024);
+    holder::heap.set_growable(true);
+    inblock_allocator<uint8_t, holder> allocator;
+
+    constexpr size_t block_size = 512 * 1024;
+    for (size_t i = 0; i < 10; i++) {
+        allocator.allocate(block_size);
+    }
+    const region_list &regions = holder::heap.get_regions();
+    BOOST_TEST(regions.get_mapped_size() >= 10 * block_size);
+    // Regions of 1, 2, 4 and 8 MiB at most.
+    BOOST_TEST(regions.get_count() <= 4);
+    holder::heap.set_growable(false);
+}
+
+BOOST_AUTO_TEST_CASE(growable_empty_older_region_is_unmapped)
+{
+    init_tlsf_heap(16 * 1024);
+    holder::heap.set_growable(true);
+    inblock_allocator<uint8_t, holder> allocator;
+
+    uint8_t *small = allocator.allocate(100 * 1024);
+    uint8_t *big = allocator.allocate(2 * region_list::min_region_size);
+    BOOST_TEST(holder::heap.get_regions().get_count() == 2);
+
+    allocator.deallocate(small, 100 * 1024);
+    BOOST_TEST(holder::heap.get_regions().get_count() == 1);
+    allocator.deallocate(big, 2 * region_list::min_region_size);
+    BOOST_TEST(holder::heap.get_regions().get_count() == 1);
+
+    holder::heap.reset();
+    BOOST_TEST(holder::heap.get_regions().get_count() == 0);
+    holder::heap.set_growable(false);
+}
+
+BOOST_AUTO_TEST_CASE(growable_region_blocks_resize_in_place)
+{
+    init_heap(16 * 1024);
+    holder::heap.set_growable(true);
+    inblock_allocator<uint8_t, holder> allocator;
+
+    uint8_t *data = allocator.allocate(64 * 1024);
+    BOOST_TEST(holder::heap.get_regions().get_count() == 1);
+    BOOST_TEST(allocator.try_expand(data, 64 * 1024, 128 * 1024));
+    BOOST_TEST(allocator.try_shrink(data, 128 * 1024, 1024));
+    BOOST_TEST(holder::heap.get_regions().check());
+    allocator.deallocate(data, 1024);
+    holder::heap.set_growable(false);
+}
+
+BOOST_AUTO_TEST_CASE(growable_thread_safe_heap_test)
+{
+    init_tlsf_heap(64 * 1024);
+    holder::heap.set_growable(true);
+    holder::heap.set_thread_safe(true);
+
+    std::vector<std::thread> threads;
+    std::vector<std::exception_ptr> errors(4);
+    for (unsigned i = 0; i < 4; i++) {
+        threads.emplace_back([i, &errors]() {
+            try {
+                alloc_free_in_thread(i + 1);
+            }
+            catch (...) {
+                errors[i] = std::current_exception();
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    holder::heap.set_thread_safe(false);
+
+    for (auto &error : errors) {
+        BOOST_TEST(!error);
+    }
+    BOOST_TEST(holder::heap.get_regions().check());
+    BOOST_TEST(holder::heap.get_stats().used_blocks == 0);
+    holder::heap.set_growable(false);
+}
+
+BOOST_AUTO_TEST_CASE(monotonic_heap_does_not_grow)
+{
+    init_monotonic_heap(16 * 1024);
+    holder::heap.set_growable(true);
+    inblock_allocator<uint8_t, holder> allocator;
+
+    BOOST_CHECK_THROW(allocator.allocate(64 * 1024), allocator_exception);
+    BOOST_TEST(holder::heap.get_regions().get_count() == 0);
+    holder::heap.set_growable(false);
+}
+
+/* ===================================================================================================== */
+/* ============================== PURGE TESTS ===================================================== */
+/* ===================================================================================================== */
+
+static bool is_page_resident(address_t addr)
+{
+    unsigned char resident = 0;
+    mincore(reinterpret_cast<void *>(align_addr_down(addr, get_page_size())), get_page_size(), &resident);
+    return resident & 1;
+}
+
+BOOST_DATA_TEST_CASE(purge_releases_free_gaps, boost::unit_test::data::make(freeing_strategies), strategy)
+{
+    init_heap(1024 * 1024, strategy);
+    holder::heap.set_purge_policy({4 * get_page_size(), 0, false});
+    inblock_allocator<uint8_t, holder> allocator;
+
+    constexpr size_t block_size = 32 * 1024;
+    std::vector<uint8_t *> blocks;
+    for (size_t i = 0; i < 16; i++) {
+        uint8_t *data = allocator.allocate(block_size);
+        fill_payload(data, block_size);
+        blocks.push_back(data);
+    }
+    for (size_t i = 0; i < blocks.size(); i += 2) {
+        allocator.deallocate(blocks[i], block_size);
+    }
+    // Gaps of 32 KiB are purged, the rest of the heap after the last block too.
+    BOOST_TEST(holder::heap.purge() >= 8 * (block_size - 2 * get_page_size()));
+    BOOST_TEST(!is_page_resident(reinterpret_cast<address_t>(blocks[2]) + block_size / 2));
+    for (size_t i = 1; i < blocks.size(); i += 2) {
+        BOOST_TEST(is_page_resident(reinterpret_cast<address_t>(blocks[i]) + block_size / 2));
+        BOOST_TEST(check_payload_consistency(blocks[i], block_size));
+    }
+
+    // Purged gaps are reused as usual.
+    for (size_t i = 0; i < blocks.size(); i += 2) {
+        blocks[i] = allocator.allocate(block_size);
+        fill_payload(blocks[i], block_size);
+    }
+    for (uint8_t *data : blocks) {
+        BOOST_TEST(check_payload_consistency(data, block_size));
+        allocator.deallocate(data, block_size);
+    }
+    holder::heap.set_purge_policy({});
+    check_heap_is_empty(strategy);
+}
+
+BOOST_AUTO_TEST_CASE(purge_skips_small_gaps)
+{
+    init_tlsf_heap(256 * 1024);
+    inblock_allocator<uint8_t, holder> allocator;
+
+    // Small free blocks between used ones, the heap end is occupied.
+    std::vector<uint8_t *> blocks;
+    while (holder::heap.get_stats().largest_free_gap >= 8 * 1024) {
+        blocks.push_back(allocator.allocate(8 * 1024));
+    }
+    for (size_t i = 0; i < blocks.size(); i += 2) {
+        allocator.deallocate(blocks[i], 8 * 1024);
+    }
+    BOOST_TEST(holder::heap.purge() == 0);
+}
+
+BOOST_AUTO_TEST_CASE(purge_decays_after_deallocations)
+{
+    init_heap(1024 * 1024);
+    holder::heap.set_stats_enabled(true);
+    holder::heap.reset_stats();
+    holder::heap.set_purge_policy({get_page_size(), 256 * 1024, true});
+    inblock_allocator<uint8_t, holder> allocator;
+
+    std::vector<uint8_t *> blocks;
+    for (size_t i = 0; i < 8; i++) {
+        blocks.push_back(allocator.allocate(64 * 1024));
+    }
+    for (size_t i = 0; i < 3; i++) {
+        allocator.deallocate(blocks[i], 64 * 1024);
+    }
+    BOOST_TEST(holder::heap.get_stats().counters.purges == 0);
+    allocator.deallocate(blocks[3], 64 * 1024);
+    BOOST_TEST(holder::heap.get_stats().counters.purges == 1);
+    BOOST_TEST(holder::heap.get_stats().counters.purged_bytes > 0);
+    BOOST_TEST(are_chunks_consistent(holder::heap));
+
+    holder::heap.set_purge_policy({});
+    holder::heap.set_stats_enabled(false);
+}
+
+BOOST_AUTO_TEST_CASE(purge_monotonic_heap_after_rewind)
+{
+    init_monotonic_heap(1024 * 1024);
+    inblock_allocator<uint8_t, holder> allocator;
+    {
+        arena_scope scope{holder::heap};
+        fill_payload(allocator.allocate(512 * 1024), 512 * 1024);
+    }
+    BOOST_TEST(holder::heap.purge() >= 1024 * 1024 - holder::heap.get_purge_policy().min_gap);
+}
+
+/* ===================================================================================================== */
+/* ============================== MAPPED REGION TESTS ===================================================== */
+/* ===================================================================================================== */
+
+BOOST_AUTO_TEST_CASE(mapped_region_rounds_to_pages)
+{
+    mapped_region region{10000};
+    BOOST_TEST((region.get_backing() == page_backing::base));
+    BOOST_TEST(region.get_size() == align_size_up(10000, get_page_size()));
+    BOOST_TEST(reinterpret_cast<address_t>(region.get_data()) % get_page_size() == 0);
+    // Untouched pages are not resident.
+    BOOST_TEST(!is_page_resident(reinterpret_cast<address_t>(region.get_data())));
+}
+
+BOOST_AUTO_TEST_CASE(mapped_region_prefaults_pages)
+{
+    mapped_region region{256 * 1024, {false, true}};
+    auto data_addr = reinterpret_cast<address_t>(region.get_data());
+    for (address_t addr = data_addr; addr < data_addr + region.get_size(); addr += get_page_size()) {
+        BOOST_TEST_REQUIRE(is_page_resident(addr));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(mapped_region_with_huge_pages)
+{
+    // Falls back to base pages where huge pages are not available.
+    mapped_region region{3 * 1024 * 1024, {true, true}};
+    BOOST_TEST_MESSAGE("Huge page backing = " << static_cast<int>(region.get_backing()));
+    if (region.get_backing() != page_backing::base) {
+        BOOST_TEST(reinterpret_cast<address_t>(region.get_data()) % huge_page_size == 0);
+        BOOST_TEST(region.get_size() == 2 * huge_page_size);
+    }
+
+    holder::heap(region.get_data(), region.get_size(), allocation_strategy::tlsf);
+    inblock_allocator<uint8_t, holder> allocator;
+    uint8_t *data = allocator.allocate(2 * 1024 * 1024);
+    fill_payload(data, 2 * 1024 * 1024);
+    BOOST_TEST(check_payload_consistency(data, 2 * 1024 * 1024));
+    allocator.deallocate(data, 2 * 1024 * 1024);
+    BOOST_TEST(holder::heap.get_tlsf_pool().check());
+}
+
+/* ===================================================================================================== */
+/* ============================== HEAP FILE TESTS ===================================================== */
+/* ===================================================================================================== */
+
+struct persistent_node_t {
+    uint64_t next_offset;
+    uint64_t value;
+};
+
+BOOST_AUTO_TEST_CASE(heap_file_keeps_data_across_reopening)
+{
+    const std::string path = "unit_tests_heap.bin";
+    std::remove(path.c_str());
+    {
+        heap_file file{holder::heap, path, 256 * 1024};
+        BOOST_TEST(file.is_created());
+        inblock_allocator<persistent_node_t, holder> allocator;
+        inblock_allocator<uint8_t, holder> byte_allocator;
+
+        // List of nodes linked by offsets, with holes between them.
+        std::vector<uint8_t *> holes;
+        persistent_node_t *head = nullptr;
+        for (uint64_t i = 0; i < 100; i++) {
+            holes.push_back(byte_allocator.allocate(1 + i));
+            auto node = allocator.allocate(1);
+            node->value = i;
+            node->next_offset = file.get_offset(head);
+            head = node;
+        }
+        for (uint64_t i = 0; i < holes.size(); i++) {
+            byte_allocator.deallocate(holes[i], 1 + i);
+        }
+        file.set_root(head);
+    }
+    {
+        heap_file file{holder::heap, path, 0};
+        BOOST_TEST(!file.is_created());
+        BOOST_TEST(are_chunks_consistent(holder::heap));
+        BOOST_TEST(holder::heap.get_stats().used_blocks == 100);
+
+        inblock_allocator<persistent_node_t, holder> allocator;
+        uint64_t expected_value = 100;
+        auto node = file.get_root<persistent_node_t>();
+        while (node) {
+            BOOST_TEST(node->value == --expected_value);
+            auto next = file.get_pointer<persistent_node_t>(node->next_offset);
+            allocator.deallocate(node, 1);
+            node = next;
+        }
+        BOOST_TEST(expected_value == 0);
+        BOOST_TEST(holder::heap.get_stats().used_blocks == 0);
+        file.set_root(nullptr);
+    }
+    {
+        heap_file file{holder::heap, path, 0};
+        BOOST_TEST(!file.get_root<persistent_node_t>());
+        BOOST_TEST(holder::heap.get_stats().largest_free_gap == holder::heap.get_size() - chunk_header_size);
+    }
+    std::remove(path.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(heap_file_rejects_other_files)
+{
+    const std::string path = "unit_tests_not_heap.bin";
+    std::ofstream{path} << std::string(2 * get_page_size(), 'x');
+    BOOST_CHECK_THROW((heap_file{holder::heap, path, 0}), allocator_exception);
+    std::remove(path.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(attach_rejects_inconsistent_memory)
+{
+    init_heap(64 * 1024);
+    inblock_allocator<uint64_t, holder> allocator;
+    uint64_t *data = allocator.allocate(100);
+    std::fill(data, data + 100, 0);
+    holder::heap.attach(reinterpret_cast<void *>(holder::heap.get_start_addr()), holder::heap.get_size());
+    BOOST_TEST(holder::heap.get_stats().used_blocks == 1);
+
+    // Header of the block after the data is overwritten.
+    std::fill(data, data + 101, UINT64_MAX);
+    BOOST_CHECK_THROW(holder::heap.attach(reinterpret_cast<void *>(holder::heap.get_start_addr()),
+                                          holder::heap.get_size()), allocator_exception);
+}
+
+/* ===================================================================================================== */
+/* ============================== SHARED HEAP TESTS ===================================================== */
+/* ===================================================================================================== */
+
+template<typename T>
+using shared_vector = std::vector<T, inblock_allocator<T, other_holder>>;
+
+/// Published through the root of the shared heap, the vector itself lives in the heap too.
+struct shared_vector_view_t {
+    uint64_t size;
+    uint64_t data_offset;
+};
+
+/// Runs func in a child process, exceptions and false results turn into a failure exit status.
+template<typename Func>
+static pid_t start_child_process(Func func)
+{
+    pid_t child = fork();
+    if (child == 0) {
+        bool passed = false;
+        try {
+            passed = func();
+        }
+        catch (...) {
+        }
+        _exit(passed ? 0 : 1);
+    }
+    return child;
+}
+
+static bool has_child_passed(pid_t child)
+{
+    int status = 0;
+    waitpid(child, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/// Shared heap turns the caches off and locking on, the other tests expect the defaults.
+static void restore_heap_settings()
+{
+    for (inblock_allocator_heap *heap : {&holder::heap, &other_holder::heap}) {
+        heap->set_thread_caches(true);
+        heap->set_thread_safe(false);
+    }
+}
+
+static std::string get_segment_name()
+{
+    return "/inblock_unit_tests_" + std::to_string(getpid());
+}
+
+BOOST_AUTO_TEST_CASE(shared_heap_exchanges_vector_between_processes)
+{
+    const std::string name = get_segment_name();
+    shared_heap segment{holder::heap, name, 1024 * 1024};
+
+    // The child maps the segment on its own, builds the vector and publishes it.
+    pid_t child = start_child_process([&name]() {
+        shared_heap child_segment{other_holder::heap, name};
+        auto vector = new (inblock_allocator<shared_vector<int>, other_holder>{}.allocate(1)) shared_vector<int>(10000);
+        std::iota(vector->begin(), vector->end(), 0);
+
+        auto view = inblock_allocator<shared_vector_view_t, other_holder>{}.allocate(1);
+        view->size = vector->size();
+        view->data_offset = child_segment.get_offset(vector->data());
+        child_segment.set_root(view);
+        return true;
+    });
+    BOOST_TEST_REQUIRE(has_child_passed(child));
+
+    // Read in place, nothing is copied.
+    auto view = segment.get_root<shared_vector_view_t>();
+    BOOST_TEST_REQUIRE(view);
+    BOOST_TEST(view->size == 10000);
+    const int *data = segment.get_pointer<int>(view->data_offset);
+    BOOST_TEST((holder::heap.get_start_addr() <= reinterpret_cast<address_t>(data) &&
+                reinterpret_cast<address_t>(data + view->size) <= holder::heap.get_end_addr()));
+    for (int i = 0; i < 10000; i++) {
+        BOOST_TEST_REQUIRE(data[i] == i);
+    }
+    BOOST_TEST(holder::heap.get_stats().used_blocks == 3);
+    BOOST_TEST(are_chunks_consistent(holder::heap));
+    shared_heap::remove(name);
+    restore_heap_settings();
+}
+
+BOOST_AUTO_TEST_CASE(shared_heap_allocates_from_two_processes)
+{
+    const std::string name = get_segment_name();
+    shared_heap segment{holder::heap, name, 4 * 1024 * 1024};
+
+    auto alloc_free = [](auto allocator, unsigned seed) {
+        std::mt19937 rng{seed};
+        std::vector<std::pair<uint8_t *, size_t>> allocated_data;
+        for (size_t i = 0; i < 20000; i++) {
+            if (!allocated_data.empty() && rng() % 2 == 0) {
+                size_t idx = rng() % allocated_data.size();
+                if (!check_payload_consistency(allocated_data[idx].first, allocated_data[idx].second)) {
+                    return false;
+                }
+                allocator.deallocate(allocated_data[idx].first, allocated_data[idx].second);
+                allocated_data[idx] = allocated_data.back();
+                allocated_data.pop_back();
+            }
+            else {
+                size_t data_size = 1 + rng() % 600;
+                uint8_t *data = allocator.allocate(data_size);
+                fill_payload(data, data_size);
+                allocated_data.emplace_back(data, data_size);
+            }
+        }
+        for (auto &&allocated_item : allocated_data) {
+            allocator.deallocate(allocated_item.first, allocated_item.second);
+        }
+        return true;
+    };
+
+    pid_t child = start_child_process([&name, &alloc_free]() {
+        shared_heap child_segment{other_holder::heap, name};
+        return alloc_free(inblock_allocator<uint8_t, other_holder>{}, 2);
+    });
+    BOOST_TEST(alloc_free(inblock_allocator<uint8_t, holder>{}, 1));
+
+    BOOST_TEST(has_child_passed(child));
+    BOOST_TEST(are_chunks_consistent(holder::heap));
+    BOOST_TEST(holder::heap.get_stats().used_blocks == 0);
+    shared_heap::remove(name);
+    restore_heap_settings();
+}
+
+BOOST_AUTO_TEST_CASE(shared_heap_next_fit_follows_merges_of_other_mapping)
+{
+    const std::string name = get_segment_name();
+    shared_heap segment{holder::heap, name, 64 * 1024};
+    shared_heap other_segment{other_holder::heap, name};
+    inblock_allocator<uint8_t, holder, next_fit> allocator;
+    inblock_allocator<uint8_t, other_holder, next_fit> other_allocator;
+
+    // The rover ends up on the free chunk right after the last block.
+    uint8_t *first = allocator.allocate(64);
+    uint8_t *last = allocator.allocate(64);
+
+    // The other mapping merges the last block with the free chunk the rover
+    // points at, then reuses the space with a payload that would not parse as a header.
+    other_allocator.deallocate(other_segment.get_pointer<uint8_t>(segment.get_offset(last)), 64);
+    uint8_t *big = other_allocator.allocate(32 * 1024);
+    std::memset(big, 0xFF, 32 * 1024);
+
+    uint8_t *next = allocator.allocate(64);
+    fill_payload(next, 64);
+    BOOST_TEST(are_chunks_consistent(holder::heap));
+    BOOST_TEST(check_payload_consistency(next, 64));
+
+    allocator.deallocate(next, 64);
+    allocator.deallocate(first, 64);
+    other_allocator.deallocate(big, 32 * 1024);
+    BOOST_TEST(are_chunks_consistent(holder::heap));
+    shared_heap::remove(name);
+    restore_heap_settings();
+}
+
+BOOST_AUTO_TEST_CASE(shared_heap_rejects_missing_segment)
+{
+    BOOST_CHECK_THROW((shared_heap{other_holder::heap, "/inblock_unit_tests_missing"}), allocator_exception);
+}
+
+/* ===================================================================================================== */
+/* ============================== DIRECT MAPPING TESTS ================================================= */
+/* ===================================================================================================== */
+
+BOOST_DATA_TEST_CASE(huge_blocks_bypass_heap, boost::unit_test::data::make(freeing_strategies), strategy)
+{
+    init_heap(64 * 1024, strategy);
+    holder::heap.set_direct_map_threshold(256 * 1024);
+    holder::heap.set_stats_enabled(true);
+    holder::heap.reset_stats();
+    inblock_allocator<uint8_t, holder> allocator;
+
+    // Neither block fits into the heap.
+    constexpr size_t block_size = 4 * 1024 * 1024;
+    uint8_t *first = allocator.allocate(block_size);
+    uint8_t *second = allocator.allocate(block_size);
+    fill_payload(first, block_size);
+    fill_payload(second, block_size);
+    uint8_t *small = allocator.allocate(1000);
+    BOOST_TEST(holder::heap.get_start_addr() <= reinterpret_cast<address_t>(small));
+    BOOST_TEST(reinterpret_cast<address_t>(small) < holder::heap.get_end_addr());
+
+    heap_stats_t stats = holder::heap.get_stats();
+    BOOST_TEST(stats.direct_count == 2);
+    BOOST_TEST(stats.direct_bytes >= 2 * block_size);
+    BOOST_TEST(stats.used_blocks == 3);
+    BOOST_TEST(stats.counters.live_bytes >= 2 * block_size);
+
+    BOOST_TEST(check_payload_consistency(first, block_size));
+    allocator.deallocate(first, block_size);
+    BOOST_TEST(holder::heap.get_direct_mappings().get_count() == 1);
+    BOOST_TEST(check_payload_consistency(second, block_size));
+    allocator.deallocate(second, block_size);
+    allocator.deallocate(small, 1000);
+
+    stats = holder::heap.get_stats();
+    BOOST_TEST(stats.direct_count == 0);
+    BOOST_TEST(stats.direct_bytes == 0);
+    BOOST_TEST(stats.counters.live_bytes == 0);
+    holder::heap.set_stats_enabled(false);
+    holder::heap.set_direct_map_threshold(0);
+}
+
+BOOST_AUTO_TEST_CASE(direct_mappings_honour_alignment)
+{
+    init_heap(64 * 1024);
+    holder::heap.set_direct_map_threshold(64 * 1024);
+    inblock_allocator<uint8_t, holder> allocator;
+
+    for (size_t align = alignment; align <= max_alignment; align *= 2) {
+        uint8_t *data = allocator.allocate_aligned(100 * 1024, align);
+        BOOST_TEST(reinterpret_cast<address_t>(data) % align == 0);
+        fill_payload(data, 100 * 1024);
+        BOOST_TEST(check_payload_consistency(data, 100 * 1024));
+        allocator.deallocate_aligned(data, 100 * 1024, align);
+    }
+    BOOST_TEST(holder::heap.get_direct_mappings().get_count() == 0);
+    holder::heap.set_direct_map_threshold(0);
+}
+
+BOOST_AUTO_TEST_CASE(direct_mappings_resize_in_place)
+{
+    init_heap(64 * 1024);
+    holder::heap.set_direct_map_threshold(64 * 1024);
+    inblock_allocator<uint8_t, holder> allocator;
+
+    auto result = allocator.allocate_at_least(100 * 1024);
+    BOOST_TEST(result.count >= 100 * 1024);
+    BOOST_TEST(result.count % get_page_size() != 0);
+    fill_payload(result.ptr, 100 * 1024);
+
+    BOOST_TEST(allocator.try_shrink(result.ptr, 100 * 1024, 70 * 1024));
+    BOOST_TEST(holder::heap.get_direct_mappings().get_mapped_size() < 100 * 1024);
+    // The block would move between the heap and its mapping.
+    BOOST_TEST(!allocator.try_shrink(result.ptr, 70 * 1024, 1024));
+    BOOST_TEST(check_payload_consistency(result.ptr, 70 * 1024));
+    allocator.deallocate(result.ptr, 70 * 1024);
+
+    uint8_t *small = allocator.allocate(1024);
+    BOOST_TEST(!allocator.try_expand(small, 1024, 128 * 1024));
+    allocator.deallocate(small, 1024);
+    holder::heap.set_direct_map_threshold(0);
+}
+
+BOOST_AUTO_TEST_CASE(merged_tlsf_block_at_threshold_is_not_freed_as_mapping)
+{
+    init_tlsf_heap(64 * 1024);
+    holder::heap.set_direct_map_threshold(4096);
+    inblock_allocator<uint8_t, holder> allocator;
+
+    // Both blocks merge into a free one of just the threshold size.
+    uint8_t *first = allocator.allocate(2040);
+    uint8_t *second = allocator.allocate(2040);
+    uint8_t *guard = allocator.allocate(8);
+    allocator.deallocate(first, 2040);
+    allocator.deallocate(second, 2040);
+
+    auto result = allocator.allocate_at_least(4088);
+    BOOST_TEST(result.ptr == first);
+    BOOST_TEST(result.count < holder::heap.get_direct_map_threshold());
+    allocator.deallocate(result.ptr, result.count);
+    BOOST_TEST(holder::heap.get_direct_mappings().get_count() == 0);
+    allocator.deallocate(guard, 8);
+    BOOST_TEST(holder::heap.get_tlsf_pool().check());
+    BOOST_TEST(count_tlsf_blocks(true) == 0);
+    holder::heap.set_direct_map_threshold(0);
+}
+
+BOOST_AUTO_TEST_CASE(reset_unmaps_direct_mappings)
+{
+    init_tlsf_heap(64 * 1024);
+    holder::heap.set_direct_map_threshold(64 * 1024);
+    inblock_allocator<uint8_t, holder> allocator;
+
+    allocator.allocate(1024 * 1024);
+    allocator.allocate(1024 * 1024);
+    BOOST_TEST(holder::heap.get_direct_mappings().get_count() == 2);
+    holder::heap.reset();
+    BOOST_TEST(holder::heap.get_direct_mappings().get_count() == 0);
+    BOOST_TEST(holder::heap.get_direct_mappings().get_mapped_size() == 0);
+    holder::heap.set_direct_map_threshold(0);
+}
+
+BOOST_AUTO_TEST_CASE(monotonic_heap_ignores_direct_map_threshold)
+{
+    init_monotonic_heap(1024 * 1024);
+    holder::heap.set_direct_map_threshold(64 * 1024);
+    inblock_allocator<uint8_t, holder> allocator;
+
+    uint8_t *data = allocator.allocate(128 * 1024);
+    BOOST_TEST(reinterpret_cast<address_t>(data) < holder::heap.get_end_addr());
+    BOOST_TEST(holder::heap.get_direct_mappings().get_count() == 0);
+    holder::heap.set_direct_map_threshold(0);
+}
+
+BOOST_AUTO_TEST_CASE(thread_safe_heap_maps_huge_blocks)
+{
+    init_heap(1024 * 1024);
+    holder::heap.set_thread_safe(true);
+    holder::heap.set_direct_map_threshold(64 * 1024);
+
+    std::vector<std::thread> threads;
+    std::atomic<bool> consistent{true};
+    for (size_t t = 0; t < 4; t++) {
+        threads.emplace_back([&consistent]() {
+            inblock_allocator<uint8_t, holder> allocator;
+            for (size_t i = 0; i < 200; i++) {
+                size_t block_size = i % 2 == 0 ? 200 * 1024 : 200;
+                uint8_t *data = allocator.allocate(block_size);
+                fill_payload(data, block_size);
+                if (!check_payload_consistency(data, block_size)) {
+                    consistent = false;
+                }
+                allocator.deallocate(data, block_size);
+            }
+            holder::heap.flush_thread_cache();
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    BOOST_TEST(consistent);
+    BOOST_TEST(holder::heap.get_direct_mappings().get_count() == 0);
+    holder::heap.set_direct_map_threshold(0);
+    holder::heap.set_thread_safe(false);
+}
+
+/* ===================================================================================================== */
+/* ============================== GAP BITMAP TESTS ===================================================== */
+/* ===================================================================================================== */
+
+/// Bits of the gap bitmap match the free chunks granule by granule.
+static bool is_gap_bitmap_consistent(const inblock_allocator_heap &heap)
+{
+    const gap_bitmap &gaps = heap.get_gap_bitmap();
+    if (gaps.get_bit_count() != heap.get_size() / alignment) {
+        return false;
+    }
+    bool consistent = true;
+    size_t granule = 0;
+    heap.for_each_chunk([&](void *, size_t payload_size, bool used) {
+        for (size_t i = 0; i < (chunk_header_size + payload_size) / alignment; i++, granule++) {
+            consistent = consistent && gaps.test(granule) == !used;
+        }
+    });
+    return consistent && granule == gaps.get_bit_count();
+}
+
+BOOST_AUTO_TEST_CASE(gap_bitmap_finds_runs_across_words)
+{
+    gap_bitmap gaps;
+    gaps.assign(1000);
+    BOOST_TEST(gaps.count() == 0);
+    BOOST_TEST(gaps.find_run(0, 1) == gap_bitmap::npos);
+
+    gaps.assign_range(10, 20, true);
+    gaps.assign_range(60, 200, true);
+    gaps.assign_range(990, 1000, true);
+    BOOST_TEST(gaps.count() == 160);
+    BOOST_TEST(gaps.find_run(0, 10) == 10);
+    BOOST_TEST(gaps.find_run(0, 11) == 60);
+    BOOST_TEST(gaps.find_run(15, 5) == 15);
+    BOOST_TEST(gaps.find_run(15, 6) == 60);
+    BOOST_TEST(gaps.find_run(0, 140) == 60);
+    BOOST_TEST(gaps.find_run(0, 141) == gap_bitmap::npos);
+    BOOST_TEST(gaps.find_run(200, 10) == 990);
+
+    gaps.assign_range(64, 128, false);
+    BOOST_TEST(!gaps.test(64));
+    BOOST_TEST(gaps.test(63));
+    BOOST_TEST(gaps.test(128));
+    BOOST_TEST(gaps.find_run(0, 50) == 128);
+
+    // Reused memory starts cleared.
+    gaps.assign(500);
+    BOOST_TEST(gaps.count() == 0);
+}
+
+/// Random allocations and deallocations, returns payload offsets from the heap start.
+template<typename FitPolicy = first_fit>
+static std::vector<size_t> run_random_chunk_workload(bool use_gap_bitmap)
+{
+    init_heap(256 * 1024);
+    holder::heap.set_gap_bitmap(use_gap_bitmap);
+    inblock_allocator<uint8_t, holder, FitPolicy> allocator;
+
+    std::mt19937 rng{7};
+    std::vector<size_t> offsets;
+    std::vector<std::pair<uint8_t *, size_t>> allocated_data;
+    for (size_t i = 0; i < 5000; i++) {
+        if (!allocated_data.empty() && rng() % 3 == 0) {
+            size_t idx = rng() % allocated_data.size();
+            allocator.deallocate(allocated_data[idx].first, allocated_data[idx].second);
+            allocated_data[idx] = allocated_data.back();
+            allocated_data.pop_back();
+        }
+        else {
+            size_t data_size = 1 + rng() % 200;
+            uint8_t *data = rng() % 8 == 0 ? allocator.allocate_aligned(data_size, 64) : allocator.allocate(data_size);
+            allocated_data.emplace_back(data, data_size);
+            offsets.push_back(reinterpret_cast<address_t>(data) - holder::heap.get_start_addr());
+        }
+        if (i % 500 == 0) {
+            BOOST_TEST_REQUIRE(are_chunks_consistent(holder::heap));
+            BOOST_TEST_REQUIRE((!use_gap_bitmap || is_gap_bitmap_consistent(holder::heap)));
+        }
+    }
+    for (auto &&allocated_item : allocated_data) {
+        allocator.deallocate(allocated_item.first, allocated_item.second);
+    }
+    if (use_gap_bitmap) {
+        BOOST_TEST(is_gap_bitmap_consistent(holder::heap));
+        BOOST_TEST(holder::heap.get_gap_bitmap().count() == holder::heap.get_size() / alignment);
+    }
+    holder::heap.set_gap_bitmap(false);
+    return offsets;
+}
+
+BOOST_AUTO_TEST_CASE(gap_bitmap_chooses_same_gaps_as_walk)
+{
+    std::vector<size_t> walk_offsets = run_random_chunk_workload(false);
+    std::vector<size_t> bitmap_offsets = run_random_chunk_workload(true);
+    BOOST_TEST(walk_offsets == bitmap_offsets, boost::test_tools::per_element());
+}
+
+BOOST_AUTO_TEST_CASE(gap_bitmap_follows_resize_in_place)
+{
+    init_heap(64 * 1024);
+    holder::heap.set_gap_bitmap(true);
+    inblock_allocator<uint8_t, holder> allocator;
+
+    uint8_t *first = allocator.allocate(100);
+    uint8_t *second = allocator.allocate(100);
+    allocator.deallocate(second, 100);
+    BOOST_TEST(allocator.try_expand(first, 100, 1000));
+    BOOST_TEST(is_gap_bitmap_consistent(holder::heap));
+    BOOST_TEST(allocator.try_shrink(first, 1000, 200));
+    BOOST_TEST(is_gap_bitmap_consistent(holder::heap));
+    allocator.deallocate(first, 200);
+    BOOST_TEST(is_gap_bitmap_consistent(holder::heap));
+    holder::heap.set_gap_bitmap(false);
+}
+
+BOOST_AUTO_TEST_CASE(gap_bitmap_is_built_for_used_heap)
+{
+    init_heap(64 * 1024);
+    inblock_allocator<uint8_t, holder> allocator;
+    std::vector<uint8_t *> blocks;
+    for (size_t i = 0; i < 100; i++) {
+        blocks.push_back(allocator.allocate(100));
+    }
+    for (size_t i = 0; i < blocks.size(); i += 2) {
+        allocator.deallocate(blocks[i], 100);
+    }
+
+    holder::heap.set_gap_bitmap(true);
+    BOOST_TEST(is_gap_bitmap_consistent(holder::heap));
+    // The first gap big enough is the one after the last block.
+    uint8_t *data = allocator.allocate(300);
+    BOOST_TEST(data > blocks.back());
+    BOOST_TEST(is_gap_bitmap_consistent(holder::heap));
+
+    holder::heap.set_gap_bitmap(false);
+    BOOST_TEST(!holder::heap.get_gap_bitmap().is_allocated());
+}
+
+BOOST_AUTO_TEST_CASE(gap_bitmap_is_dropped_by_other_strategies)
+{
+    init_tlsf_heap(64 * 1024);
+    holder::heap.set_gap_bitmap(true);
+    BOOST_TEST(!holder::heap.uses_gap_bitmap());
+    BOOST_TEST(!holder::heap.get_gap_bitmap().is_allocated());
+    holder::heap.set_gap_bitmap(false);
+}
+
+/* ===================================================================================================== */
+/* ============================== FIT POLICY TESTS ===================================================== */
+/* ===================================================================================================== */
+
+BOOST_AUTO_TEST_CASE(next_fit_resumes_after_last_allocation)
+{
+    init_heap(64 * 1024);
+    inblock_allocator<uint8_t, holder, next_fit> allocator;
+
+    uint8_t *first = allocator.allocate(100);
+    uint8_t *second = allocator.allocate(100);
+    allocator.deallocate(first, 100);
+    uint8_t *third = allocator.allocate(100);
+    BOOST_TEST(third > second);
+
+    // First fit starts at the heap start again.
+    inblock_allocator<uint8_t, holder> first_fit_allocator;
+    BOOST_TEST(first_fit_allocator.allocate(100) == first);
+    BOOST_TEST(are_chunks_consistent(holder::heap));
+}
+
+BOOST_AUTO_TEST_CASE(next_fit_wraps_around_heap_end)
+{
+    init_heap(16 * 1024);
+    inblock_allocator<uint8_t, holder, next_fit> allocator;
+
+    std::vector<uint8_t *> blocks;
+    while (holder::heap.get_stats().largest_free_gap >= 1000) {
+        blocks.push_back(allocator.allocate(1000));
+    }
+    allocator.deallocate(blocks[0], 1000);
+    BOOST_TEST(allocator.allocate(1000) == blocks[0]);
+    BOOST_TEST(are_chunks_consistent(holder::heap));
+}
+
+BOOST_AUTO_TEST_CASE(next_fit_rover_follows_merged_chunk)
+{
+    init_heap(64 * 1024);
+    inblock_allocator<uint8_t, holder, next_fit> allocator;
+
+    uint8_t *first = allocator.allocate(100);
+    uint8_t *second = allocator.allocate(100);
+    // The rover points to the free rest of the heap, which merges into the freed block.
+    allocator.deallocate(second, 100);
+    BOOST_TEST(allocator.allocate(200) == second);
+    allocator.deallocate(first, 100);
+    BOOST_TEST(are_chunks_consistent(holder::heap));
+}
+
+BOOST_AUTO_TEST_CASE(best_fit_picks_smallest_gap)
+{
+    init_heap(64 * 1024);
+    inblock_allocator<uint8_t, holder, best_fit> allocator;
+
+    std::vector<uint8_t *> blocks;
+    for (size_t block_size : {304, 8, 104, 8, 200, 8}) {
+        blocks.push_back(allocator.allocate(block_size));
+    }
+    allocator.deallocate(blocks[0], 304);
+    allocator.deallocate(blocks[2], 104);
+    allocator.deallocate(blocks[4], 200);
+
+    BOOST_TEST(allocator.allocate(104) == blocks[2]);
+    BOOST_TEST(allocator.allocate(150) == blocks[4]);
+    inblock_allocator<uint8_t, holder> first_fit_allocator;
+    BOOST_TEST(first_fit_allocator.allocate(100) == blocks[0]);
+    BOOST_TEST(are_chunks_consistent(holder::heap));
+}
+
+BOOST_AUTO_TEST_CASE(best_fit_honours_alignment)
+{
+    init_heap(64 * 1024);
+    inblock_allocator<uint8_t, holder, best_fit> allocator;
+
+    for (size_t align = alignment; align <= 1024; align *= 2) {
+        uint8_t *data = allocator.allocate_aligned(100, align);
+        BOOST_TEST(reinterpret_cast<address_t>(data) % align == 0);
+        allocator.allocate(8);
+    }
+    BOOST_TEST(are_chunks_consistent(holder::heap));
+}
+
+BOOST_AUTO_TEST_CASE(fit_policies_choose_same_gaps_with_gap_bitmap)
+{
+    BOOST_TEST(run_random_chunk_workload<next_fit>(false) == run_random_chunk_workload<next_fit>(true),
+               boost::test_tools::per_element());
+    BOOST_TEST(run_random_chunk_workload<best_fit>(false) == run_random_chunk_workload<best_fit>(true),
+               boost::test_tools::per_element());
+}
+
+BOOST_AUTO_TEST_CASE(fit_policies_share_one_heap)
+{
+    init_heap(256 * 1024);
+    inblock_allocator<uint8_t, holder, first_fit> first_fit_allocator;
+    inblock_allocator<uint8_t, holder, next_fit> next_fit_allocator;
+    inblock_allocator<uint8_t, holder, best_fit> best_fit_allocator;
+
+    std::mt19937 rng{11};
+    std::vector<std::pair<uint8_t *, size_t>> allocated_data;
+    for (size_t i = 0; i < 3000; i++) {
+        if (!allocated_data.empty() && rng() % 3 == 0) {
+            size_t idx = rng() % allocated_data.size();
+            BOOST_TEST_REQUIRE(check_payload_consistency(allocated_data[idx].first, allocated_data[idx].second));
+            first_fit_allocator.deallocate(allocated_data[idx].first, allocated_data[idx].second);
+            allocated_data[idx] = allocated_data.back();
+            allocated_data.pop_back();
+            continue;
+        }
+        size_t data_size = 1 + rng() % 300;
+        uint8_t *data = i % 3 == 0 ? first_fit_allocator.allocate(data_size) :
+                        i % 3 == 1 ? next_fit_allocator.allocate(data_size) : best_fit_allocator.allocate(data_size);
+        fill_payload(data, data_size);
+        allocated_data.emplace_back(data, data_size);
+    }
+    BOOST_TEST(are_chunks_consistent(holder::heap));
+    for (auto &&allocated_item : allocated_data) {
+        next_fit_allocator.deallocate(allocated_item.first, allocated_item.second);
+    }
+    BOOST_TEST(holder::heap.get_stats().used_blocks == 0);
+}
+
+/* ===================================================================================================== */
+/* ============================== MEMORY RESOURCE TESTS ================================================ */
+/* ===================================================================================================== */
+
+BOOST_DATA_TEST_CASE(pmr_containers_draw_from_heap, boost::unit_test::data::make(freeing_strategies), strategy)
+{
+    init_heap(1024 * 1024, strategy);
+    holder::heap.set_stats_enabled(true);
+    holder::heap.reset_stats();
+    inblock_memory_resource resource{holder::heap};
+    {
+        std::pmr::vector<int> numbers{&resource};
+        std::pmr::map<int, std::pmr::string> names{&resource};
+        for (int i = 0; i < 1000; i++) {
+            numbers.push_back(i);
+            names.emplace(i, std::pmr::string(100, static_cast<char>('a' + i % 26)));
+        }
+        BOOST_TEST(holder::heap.get_start_addr() <= reinterpret_cast<address_t>(numbers.data()));
+        BOOST_TEST(reinterpret_cast<address_t>(numbers.data()) < holder::heap.get_end_addr());
+        BOOST_TEST(holder::heap.get_stats().counters.live_blocks > 1000);
+        BOOST_TEST(std::accumulate(numbers.begin(), numbers.end(), 0) == 999 * 1000 / 2);
+        BOOST_TEST(names.at(27) == std::pmr::string(100, 'b'));
+    }
+    BOOST_TEST(holder::heap.get_stats().counters.live_bytes == 0);
+    holder::heap.set_stats_enabled(false);
+}
+
+BOOST_AUTO_TEST_CASE(memory_resource_honours_alignment)
+{
+    init_heap(64 * 1024);
+    inblock_memory_resource resource{holder::heap};
+
+    std::vector<std::pair<void *, size_t>> blocks;
+    for (size_t align = 1; align <= max_alignment; align *= 2) {
+        void *ptr = resource.allocate(100, align);
+        BOOST_TEST(reinterpret_cast<address_t>(ptr) % align == 0);
+        blocks.emplace_back(ptr, align);
+    }
+    for (auto &&block : blocks) {
+        resource.deallocate(block.first, 100, block.second);
+    }
+    BOOST_TEST(holder::heap.get_stats().used_blocks == 0);
+    BOOST_CHECK_THROW(static_cast<void>(resource.allocate(100, 2 * max_alignment)), allocator_exception);
+    BOOST_CHECK_THROW(static_cast<void>(resource.allocate(1024 * 1024)), allocator_exception);
+}
+
+BOOST_AUTO_TEST_CASE(memory_resource_puts_small_blocks_into_slabs)
+{
+    init_slab_heap(64 * 1024, allocation_strategy::chunk_list);
+    inblock_memory_resource resource{holder::heap};
+
+    // The default alignment of memory_resource is that of max_align_t, which slots do not have.
+    void *small = resource.allocate(24, alignment);
+    void *other_small = resource.allocate(24, alignment);
+    void *big = resource.allocate(1000, alignment);
+    void *aligned = resource.allocate(24, 64);
+    // Slots of one slab are next to each other, blocks have chunk headers in between.
+    BOOST_TEST(reinterpret_cast<address_t>(other_small) - reinterpret_cast<address_t>(small) == 24);
+    BOOST_TEST(reinterpret_cast<address_t>(aligned) % 64 == 0);
+    resource.deallocate(small, 24, alignment);
+    resource.deallocate(other_small, 24, alignment);
+    resource.deallocate(big, 1000, alignment);
+    resource.deallocate(aligned, 24, 64);
+    // The last slab of a size class is kept for the next slots.
+    BOOST_TEST(holder::heap.get_stats().used_blocks == 1);
+    holder::heap.set_slab_pools(false);
+}
+
+BOOST_AUTO_TEST_CASE(memory_resources_of_one_heap_are_equal)
+{
+    inblock_memory_resource resource{holder::heap};
+    inblock_memory_resource same_heap_resource{holder::heap};
+    inblock_memory_resource other_heap_resource{other_holder::heap};
+    BOOST_TEST((resource == same_heap_resource));
+    BOOST_TEST((resource != other_heap_resource));
+    BOOST_TEST((resource != *std::pmr::new_delete_resource()));
+}
+
+/* ===================================================================================================== */
+/* ============================== NODE CONTAINER TESTS ================================================= */
+/* ===================================================================================================== */
+
+template<typename T>
+using node_allocator = inblock_allocator<T, holder>;
+
+BOOST_AUTO_TEST_CASE(allocator_rebinds_to_other_types)
+{
+    using rebound = std::allocator_traits<node_allocator<int>>::rebind_alloc<double>;
+    static_assert(std::is_same<rebound, node_allocator<double>>::value, "Rebind keeps heap and policy");
+    static_assert(std::is_same<std::allocator_traits<inblock_allocator<int, holder, best_fit>>::rebind_alloc<char>,
+                               inblock_allocator<char, holder, best_fit>>::value, "Rebind keeps heap and policy");
+
+    node_allocator<int> int_allocator;
+    node_allocator<double> double_allocator{int_allocator};
+    node_allocator<int> back{double_allocator};
+    BOOST_TEST((int_allocator == double_allocator));
+    BOOST_TEST(!(back != int_allocator));
+}
+
+BOOST_DATA_TEST_CASE(node_containers_use_heap, boost::unit_test::data::make(freeing_strategies), strategy)
+{
+    init_heap(1024 * 1024, strategy);
+    holder::heap.set_stats_enabled(true);
+    holder::heap.reset_stats();
+    {
+        std::list<int, node_allocator<int>> numbers;
+        std::map<int, int, std::less<int>, node_allocator<std::pair<const int, int>>> squares;
+        std::unordered_map<int, int, std::hash<int>, std::equal_to<int>,
+                           node_allocator<std::pair<const int, int>>> cubes;
+        for (int i = 0; i < 1000; i++) {
+            numbers.push_back(i);
+            squares.emplace(i, i * i);
+            cubes.emplace(i, i * i * i);
+        }
+        BOOST_TEST(holder::heap.get_stats().counters.live_blocks >= 3000);
+
+        for (int i = 0; i < 1000; i += 2) {
+            squares.erase(i);
+            cubes.erase(i);
+        }
+        numbers.remove_if([](int value) {
+            return value % 2 == 0;
+        });
+        BOOST_TEST(numbers.size() == 500);
+        BOOST_TEST(squares.at(7) == 49);
+        BOOST_TEST(cubes.at(9) == 729);
+        BOOST_TEST(cubes.count(10) == 0);
+
+        auto shared = std::allocate_shared<std::pair<int, int>>(node_allocator<int>{}, 1, 2);
+        BOOST_TEST(shared->second == 2);
+    }
+    BOOST_TEST(holder::heap.get_stats().counters.live_bytes == 0);
+    holder::heap.set_stats_enabled(false);
+}
+
+BOOST_AUTO_TEST_CASE(node_containers_use_slabs)
+{
+    init_slab_heap(256 * 1024, allocation_strategy::chunk_list);
+    {
+        std::map<int, int, std::less<int>, node_allocator<std::pair<const int, int>>> squares;
+        for (int i = 0; i < 1000; i++) {
+            squares.emplace(i, i * i);
+        }
+        // Nodes are packed into slabs, a handful of blocks holds all of them.
+        BOOST_TEST(holder::heap.get_stats().used_blocks < 100);
+        BOOST_TEST(squares.at(30) == 900);
+    }
+    holder::heap.set_slab_pools(false);
+}
+
+/* ===================================================================================================== */
+/* ============================== BATCH ALLOCATION TESTS =============================================== */
+/* ===================================================================================================== */
+
+static uint64_t count_searches(const heap_counters_t &counters)
+{
+    return std::accumulate(std::begin(counters.walk_lengths.buckets), std::end(counters.walk_lengths.buckets),
+                           uint64_t{0});
+}
+
+BOOST_AUTO_TEST_CASE(batch_places_blocks_next_to_each_other)
+{
+    init_heap(64 * 1024);
+    holder::heap.set_stats_enabled(true);
+    holder::heap.reset_stats();
+    inblock_allocator<int, holder> allocator;
+
+    std::vector<int *> rows(50);
+    allocator.allocate_batch(20, rows.size(), rows.data());
+    for (size_t i = 1; i < rows.size(); i++) {
+        BOOST_TEST(reinterpret_cast<address_t>(rows[i]) - reinterpret_cast<address_t>(rows[i - 1]) ==
+                   chunk_header_size + 20 * sizeof(int));
+    }
+    for (int *row : rows) {
+        fill_payload(reinterpret_cast<uint8_t *>(row), 20 * sizeof(int));
+    }
+    heap_stats_t stats = holder::heap.get_stats();
+    BOOST_TEST(stats.counters.live_blocks == rows.size());
+    BOOST_TEST(count_searches(stats.counters) == 1);
+    BOOST_TEST(are_chunks_consistent(holder::heap));
+
+    for (int *row : rows) {
+        BOOST_TEST(check_payload_consistency(reinterpret_cast<uint8_t *>(row), 20 * sizeof(int)));
+    }
+    allocator.deallocate_batch(rows.data(), rows.size(), 20);
+    BOOST_TEST(holder::heap.get_stats().used_blocks == 0);
+    BOOST_TEST(holder::heap.get_stats().counters.live_bytes == 0);
+    holder::heap.set_stats_enabled(false);
+}
+
+BOOST_DATA_TEST_CASE(batch_fills_gaps_in_address_order, boost::unit_test::data::make({false, true}), use_gap_bitmap)
+{
+    init_heap(64 * 1024);
+    holder::heap.set_gap_bitmap(use_gap_bitmap);
+    inblock_allocator<uint8_t, holder> allocator;
+
+    // Gaps for two, one and three blocks of 64 bytes.
+    std::vector<uint8_t *> blocks;
+    for (size_t block_size : {136, 8, 64, 8, 208, 8}) {
+        blocks.push_back(allocator.allocate(block_size));
+    }
+    allocator.deallocate(blocks[0], 136);
+    allocator.deallocate(blocks[2], 64);
+    allocator.deallocate(blocks[4], 208);
+
+    std::vector<uint8_t *> batch(8);
+    allocator.allocate_batch(64, batch.size(), batch.data());
+    BOOST_TEST(batch[0] == blocks[0]);
+    BOOST_TEST(batch[2] == blocks[2]);
+    BOOST_TEST(batch[3] == blocks[4]);
+    BOOST_TEST(batch[6] > blocks[5]);
+    BOOST_TEST(std::is_sorted(batch.begin(), batch.end()));
+    BOOST_TEST(are_chunks_consistent(holder::heap));
+    BOOST_TEST((!use_gap_bitmap || is_gap_bitmap_consistent(holder::heap)));
+    holder::heap.set_gap_bitmap(false);
+}
+
+BOOST_AUTO_TEST_CASE(failed_batch_allocates_nothing)
+{
+    init_heap(16 * 1024);
+    inblock_allocator<uint8_t, holder> allocator;
+    uint8_t *kept = allocator.allocate(100);
+
+    std::vector<uint8_t *> batch(100);
+    BOOST_CHECK_THROW(allocator.allocate_batch(1000, batch.size(), batch.data()), allocator_exception);
+    BOOST_TEST(holder::heap.get_stats().used_blocks == 1);
+    BOOST_TEST(are_chunks_consistent(holder::heap));
+    allocator.deallocate(kept, 100);
+}
+
+BOOST_AUTO_TEST_CASE(batch_continues_in_regions_of_growable_heap)
+{
+    init_heap(16 * 1024);
+    holder::heap.set_growable(true);
+    inblock_allocator<uint8_t, holder> allocator;
+
+    std::vector<uint8_t *> batch(100);
+    allocator.allocate_batch(1000, batch.size(), batch.data());
+    BOOST_TEST(holder::heap.get_regions().get_count() >= 1);
+    BOOST_TEST(holder::heap.get_stats().used_blocks == batch.size());
+    allocator.deallocate_batch(batch.data(), batch.size(), 1000);
+    BOOST_TEST(holder::heap.get_stats().used_blocks == 0);
+    holder::heap.set_growable(false);
+}
+
+BOOST_AUTO_TEST_CASE(batch_works_with_every_heap_kind)
+{
+    init_tlsf_heap(256 * 1024);
+    inblock_allocator<uint64_t, holder> allocator;
+    std::vector<uint64_t *> batch(100);
+    allocator.allocate_batch(10, batch.size(), batch.data());
+    allocator.deallocate_batch(batch.data(), batch.size(), 10);
+    BOOST_TEST(holder::heap.get_stats().used_blocks == 0);
+
+    holder::heap.set_direct_map_threshold(64 * 1024);
+    allocator.allocate_batch(16 * 1024, 4, batch.data());
+    BOOST_TEST(holder::heap.get_direct_mappings().get_count() == 4);
+    allocator.deallocate_batch(batch.data(), 4, 16 * 1024);
+    BOOST_TEST(holder::heap.get_direct_mappings().get_count() == 0);
+    holder::heap.set_direct_map_threshold(0);
+
+    init_slab_heap(64 * 1024, allocation_strategy::chunk_list);
+    allocator.allocate_batch(1, batch.size(), batch.data());
+    BOOST_TEST(holder::heap.get_stats().used_blocks < 10);
+    allocator.deallocate_batch(batch.data(), batch.size(), 1);
+    holder::heap.set_slab_pools(false);
+}
+
+/* ===================================================================================================== */
+/* ============================== MALLOC REPLACEMENT TESTS ============================================= */
+/* ===================================================================================================== */
+
+BOOST_AUTO_TEST_CASE(malloc_payloads_are_aligned_and_usable)
+{
+    size_t blocks_before = get_malloc_heap().get_stats().used_blocks;
+    std::vector<std::pair<uint8_t *, size_t>> blocks;
+    for (size_t size = 0; size < 2000; size += 7) {
+        auto ptr = static_cast<uint8_t *>(inblock_malloc(size));
+        BOOST_TEST(reinterpret_cast<address_t>(ptr) % alignof(std::max_align_t) == 0);
+        BOOST_TEST(inblock_malloc_usable_size(ptr) >= size);
+        std::memset(ptr, static_cast<int>(size), size);
+        blocks.emplace_back(ptr, size);
+    }
+    for (auto [ptr, size] : blocks) {
+        BOOST_TEST(std::all_of(ptr, ptr + size, [size](uint8_t value) { return value == static_cast<uint8_t>(size); }));
+        inblock_free(ptr);
+    }
+    inblock_free(nullptr);
+    BOOST_TEST(get_malloc_heap().get_stats().used_blocks == blocks_before);
+}
+
+BOOST_AUTO_TEST_CASE(calloc_zeroes_reused_memory)
+{
+    void *dirty = inblock_malloc(256);
+    std::memset(dirty, 0xff, 256);
+    inblock_free(dirty);
+
+    auto ptr = static_cast<uint64_t *>(inblock_calloc(32, sizeof(uint64_t)));
+    BOOST_TEST(std::all_of(ptr, ptr + 32, [](uint64_t value) { return value == 0; }));
+    inblock_free(ptr);
+
+    errno = 0;
+    BOOST_TEST(inblock_calloc(SIZE_MAX / 2, 4) == nullptr);
+    BOOST_TEST(errno == ENOMEM);
+}
+
+BOOST_AUTO_TEST_CASE(realloc_keeps_content)
+{
+    auto ptr = static_cast<uint32_t *>(inblock_realloc(nullptr, 100 * sizeof(uint32_t)));
+    std::iota(ptr, ptr + 100, 0u);
+    // Small, shrinking and huge sizes, the last ones get a mapping of their own.
+    for (size_t count : {1000, 50000, 100, 50, 1000000, 4000000, 60}) {
+        ptr = static_cast<uint32_t *>(inblock_realloc(ptr, count * sizeof(uint32_t)));
+        BOOST_TEST(inblock_malloc_usable_size(ptr) >= count * sizeof(uint32_t));
+        for (size_t i = 0; i < 50; i++) {
+            BOOST_TEST(ptr[i] == i);
+        }
+        std::iota(ptr, ptr + count, 0u);
+    }
+    BOOST_TEST(inblock_realloc(ptr, 0) == nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(realloc_resizes_huge_blocks)
+{
+    void *ptr = inblock_malloc(2 * 1024 * 1024);
+    BOOST_TEST(get_malloc_heap().get_direct_mappings().get_count() == 1);
+    // Mapping grows by mremap or moves, shrinking stays in place.
+    ptr = inblock_realloc(ptr, 4 * 1024 * 1024);
+    void *shrunk = inblock_realloc(ptr, 1024 * 1024 + 1);
+    BOOST_TEST(shrunk == ptr);
+    inblock_free(shrunk);
+    BOOST_TEST(get_malloc_heap().get_direct_mappings().get_count() == 0);
+}
+
+BOOST_AUTO_TEST_CASE(aligned_alloc_supports_big_alignments)
+{
+    for (size_t align : {8, 16, 64, 4096, 64 * 1024}) {
+        void *ptr = inblock_aligned_alloc(align, 100);
+        BOOST_TEST(reinterpret_cast<address_t>(ptr) % align == 0);
+        BOOST_TEST(inblock_malloc_usable_size(ptr) >= 100);
+        std::memset(ptr, 1, 100);
+        void *grown = inblock_realloc(ptr, 10000);
+        BOOST_TEST(static_cast<uint8_t *>(grown)[99] == 1);
+        inblock_free(grown);
+    }
+
+    errno = 0;
+    BOOST_TEST(inblock_aligned_alloc(48, 100) == nullptr);
+    BOOST_TEST(errno == EINVAL);
+}
+
+BOOST_AUTO_TEST_CASE(malloc_is_thread_safe)
+{
+    size_t blocks_before = get_malloc_heap().get_stats().used_blocks;
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < 4; t++) {
+        threads.emplace_back([t]() {
+            std::mt19937 rng{t};
+            std::vector<void *> blocks(100, nullptr);
+            for (size_t i = 0; i < 20000; i++) {
+                void *&block = blocks[rng() % blocks.size()];
+                inblock_free(block);
+                block = inblock_malloc(rng() % 1000);
+            }
+            for (void *block : blocks) {
+                inblock_free(block);
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    BOOST_TEST(get_malloc_heap().get_stats().used_blocks == blocks_before);
+}
+
+BOOST_AUTO_TEST_CASE(malloc_works_in_child_forked_during_allocations)
+{
+    std::atomic<bool> stop{false};
+    std::thread allocating_thread{[&stop]() {
+        while (!stop) {
+            inblock_free(inblock_malloc(64));
+        }
+    }};
+
+    // Without the fork handlers some child would start with the lock held by the other thread.
+    bool all_passed = true;
+    for (size_t i = 0; i < 200; i++) {
+        pid_t child = start_child_process([]() {
+            // A deadlocked child fails the test instead of hanging it.
+            alarm(10);
+            void *ptr = inblock_malloc(128);
+            inblock_free(ptr);
+            return ptr != nullptr;
+        });
+        all_passed = has_child_passed(child) && all_passed;
+    }
+    stop = true;
+    allocating_thread.join();
+    BOOST_TEST(all_passed);
+}
@@ -0,0 +1,83 @@
+#include <iostream>
+#include <vector>
+#include "test_common.hpp"
+#include "../inblock_allocator.hpp"
+#include "../inblock_vector.hpp"
+
+/**
+ * Same workload as basic_test: fills a vector by push_back in every repetition.
+ * Elements count their moves, so the copy volume of regrowth is visible next to
+ * the wall time. inblock_vector grows in place where std::vector always moves.
+ */
+
+struct holder {
+    static inblock_allocator_heap heap;
+};
+
+inblock_allocator_heap holder::heap;
+
+constexpr size_t repetitions = 1000;
+constexpr size_t push_backs = 100000;
+
+const size_t mem_size = 25 * 100 * 1000;
+
+static size_t moves = 0;
+
+struct counted_int {
+    int value;
+
+    counted_int(int value) noexcept
+        : value{value}
+    {}
+
+    counted_int(const counted_int &other) noexcept
+        : value{other.value}
+    {
+        moves++;
+    }
+
+    counted_int(counted_int &&other) noexcept
+        : value{other.value}
+    {
+        moves++;
+    }
+};
+
+template<typename Vector>
+static void run()
+{
+    for (size_t rep = 0; rep < repetitions; ++rep) {
+        Vector v;
+        for (size_t i = 0; i < push_backs; ++i) {
+            v.emplace_back(static_cast<int>(i));
+        }
+        v.clear();
+    }
+}
+
+template<typename Vector>
+static void run_on_heap(const char *name, allocation_strategy strategy, std::vector<uint8_t> &mem)
+{
+    holder::heap(mem.data(), mem.size(), strategy);
+    moves = 0;
+    double wall_time = measure(run<Vector>);
+    std::cout << name << "\t" << wall_time << "\t\t"
+              << static_cast<double>(moves) * sizeof(counted_int) / repetitions << std::endl;
+}
+
+int main()
+{
+    std::vector<uint8_t> mem;
+    mem.resize(mem_size);
+
+    using std_vector = std::vector<counted_int, inblock_allocator<counted_int, holder>>;
+    using in_place_vector = inblock_vector<counted_int, holder>;
+
+    std::cout << "Repetitions = " << repetitions << std::endl;
+    std::cout << "Push backs = " << push_backs << std::endl;
+    std::cout << "container\t\t\twall time [s]\tbytes moved per repetition" << std::endl;
+    run_on_heap<std_vector>("std::vector, chunk list", allocation_strategy::chunk_list, mem);
+    run_on_heap<in_place_vector>("inblock_vector, chunk list", allocation_strategy::chunk_list, mem);
+    run_on_heap<std_vector>("std::vector, tlsf\t", allocation_strategy::tlsf, mem);
+    run_on_heap<in_place_vector>("inblock_vector, tlsf\t", allocation_strategy::tlsf, mem);
+}
@@ -0,0 +1,80 @@
+#ifndef THREAD_CACHE_HPP
+#define THREAD_CACHE_HPP
+
+#include <cstdint>
+#include "common.hpp"
+
+/**
+ * Per-thread bins of free blocks, one bin per small size class. Blocks in the
+ * bins stay allocated from the point of view of the heap, so a thread can reuse
+ * them without taking the heap lock. The heap refills and drains the bins in
+ * batches.
+ */
+class thread_cache {
+public:
+    static constexpr size_t size_class_count = 32;
+    static constexpr size_t max_cached_size = size_class_count * alignment;
+    static constexpr size_t max_blocks_per_class = 64;
+    static constexpr size_t refill_count = 16;
+
+    /// Size classes are spaced by alignment, so aligned sizes map to their class exactly.
+    static size_t get_size_class(size_t payload_size)
+    {
+        assert(payload_size <= max_cached_size);
+        return payload_size == 0 ? 0 : (payload_size - 1) / alignment;
+    }
+
+    static size_t get_class_payload_size(size_t size_class)
+    {
+        return (size_class + 1) * alignment;
+    }
+
+    void * pop(size_t size_class)
+    {
+        free_block_t *block = bins[size_class];
+        if (block) {
+            bins[size_class] = block->next;
+            counts[size_class]--;
+        }
+        return block;
+    }
+
+    void push(size_t size_class, void *ptr)
+    {
+        auto block = static_cast<free_block_t *>(ptr);
+        block->next = bins[size_class];
+        bins[size_class] = block;
+        counts[size_class]++;
+    }
+
+    bool is_full(size_t size_class) const
+    {
+        return counts[size_class] >= max_blocks_per_class;
+    }
+
+    uint64_t get_generation() const
+    {
+        return generation;
+    }
+
+    /// Forgets all blocks without returning them, used when the heap was re-initialized.
+    void reset(uint64_t new_generation)
+    {
+        for (size_t i = 0; i < size_class_count; ++i) {
+            bins[i] = nullptr;
+            counts[i] = 0;
+        }
+        generation = new_generation;
+    }
+
+private:
+    struct free_block_t {
+        free_block_t *next;
+    };
+
+    free_block_t *bins[size_class_count] = {};
+    size_t counts[size_class_count] = {};
+    uint64_t generation = 0;
+};
+
+#endif //THREAD_CACHE_HPP
@@ -0,0 +1,505 @@
+#ifndef TLSF_HPP
+#define TLSF_HPP
+
+#include <cstring>
+#include "common.hpp"
+#include "allocator_exception.hpp"
+
+/**
+ * Two-level segregated fit engine.
+ *
+ * Free blocks are kept in segregated lists indexed by a first level (power of two
+ * size range) and a second level (linear subdivision of that range). Two levels
+ * of bitmaps tell which lists are non-empty, so a suitable free block is found
+ * with two bit scans and both allocation and deallocation run in constant time,
+ * independently of the number of live blocks.
+ *
+ * The control structure is stored at the beginning of the managed region, so
+ * the engine itself keeps only a pointer to it.
+ */
+class tlsf_pool {
+public:
+    static constexpr size_t sl_index_count_log2 = 5;
+    static constexpr size_t sl_index_count = 1 << sl_index_count_log2;
+    static constexpr size_t align_size_log2 = 3;
+    static constexpr size_t fl_index_shift = sl_index_count_log2 + align_size_log2;
+    static constexpr size_t fl_index_max = 38;
+    static constexpr size_t fl_index_count = fl_index_max - fl_index_shift + 1;
+    static constexpr size_t small_block_size = size_t{1} << fl_index_shift;
+    /// Largest block size whose first level index still lies inside the control structure.
+    static constexpr size_t block_size_max = (size_t{1} << fl_index_max) - alignment;
+
+    /// Free blocks keep their list links at the start of the payload, the rest of it is unused.
+    static constexpr size_t free_links_size = 2 * sizeof(void *);
+
+    static_assert(size_t{1} << align_size_log2 == alignment, "TLSF granularity must match heap alignment");
+    static_assert(fl_index_count <= 32, "First level bitmap must fit into 32 bits");
+
+    /**
+     * Lays out control structure and one big free block over given region.
+     * @param start_addr Aligned start of the region.
+     * @param end_addr Aligned end of the region.
+     */
+    void initialize(address_t start_addr, address_t end_addr)
+    {
+        address_t control_addr = start_addr;
+        address_t first_block_addr = align_size_up(control_addr + sizeof(control_t));
+        if (end_addr < first_block_addr + 2 * block_header_size + min_block_size) {
+            throw allocator_exception{"More memory needed."};
+        }
+
+        control = reinterpret_cast<control_t *>(control_addr);
+        std::memset(control, 0, sizeof(control_t));
+
+        size_t first_block_size = end_addr - first_block_addr - 2 * block_header_size;
+        if (first_block_size > block_size_max) {
+            first_block_size = block_size_max;
+        }
+
+        auto first_block = reinterpret_cast<block_t *>(first_block_addr);
+        first_block->prev_phys = nullptr;
+        first_block->size_and_flags = 0;
+        set_size(first_block, first_block_size);
+
+        // Zero-sized used sentinel stops coalescing at the end of the region.
+        block_t *sentinel = get_next_phys(first_block);
+        sentinel->prev_phys = first_block;
+        sentinel->size_and_flags = 0;
+
+        mark_free(first_block);
+        insert_free_block(first_block);
+    }
+
+    void * allocate(size_t size)
+    {
+        assert(control);
+        size_t adjusted_size = adjust_request_size(size);
+        if (adjusted_size == 0) {
+            return nullptr;
+        }
+
+        block_t *block = locate_free_block(adjusted_size);
+        if (!block) {
+            return nullptr;
+        }
+
+        trim_free_block(block, adjusted_size);
+        mark_used(block);
+        return get_payload(block);
+    }
+
+    /**
+     * Allocates payload aligned to given power of two. The free space in front
+     * of the aligned payload is split off as a free block, so it is not wasted.
+     */
+    void * allocate(size_t size, size_t align)
+    {
+        if (align <= alignment) {
+            return allocate(size);
+        }
+
+        assert(control);
+        size_t adjusted_size = adjust_request_size(size);
+        // Leading gap has to be big enough to form a free block of its own.
+        const size_t gap_minimum = sizeof(block_t);
+        size_t size_with_gap = adjust_request_size(adjusted_size + align + gap_minimum);
+        if (adjusted_size == 0 || size_with_gap == 0) {
+            return nullptr;
+        }
+
+        block_t *block = locate_free_block(size_with_gap);
+        if (!block) {
+            return nullptr;
+        }
+
+        auto payload_addr = reinterpret_cast<address_t>(get_payload(block));
+        address_t aligned_addr = align_addr_up(payload_addr, align);
+        if (aligned_addr != payload_addr && aligned_addr - payload_addr < gap_minimum) {
+            aligned_addr = align_addr_up(payload_addr + gap_minimum, align);
+        }
+        if (aligned_addr != payload_addr) {
+            block_t *leading = block;
+            block = split_block(leading, aligned_addr - payload_addr - block_header_size);
+            insert_free_block(leading);
+        }
+
+        trim_free_block(block, adjusted_size);
+        mark_used(block);
+        return get_payload(block);
+    }
+
+    void deallocate(void *ptr) noexcept
+    {
+        assert(control);
+        block_t *block = get_block_from_payload(ptr);
+        assert(!is_free(block));
+
+        mark_free(block);
+        block = merge_with_prev(block);
+        block = merge_with_next(block);
+        insert_free_block(block);
+    }
+
+    /**
+     * Grows or shrinks allocated block without moving it. Growing takes space
+     * from the next block if it is free, the part not needed is split off again.
+     * @return false if the block cannot grow in place, the block is left untouched.
+     */
+    bool resize_in_place(void *ptr, size_t size)
+    {
+        assert(control);
+        size_t adjusted_size = adjust_request_size(size);
+        if (adjusted_size == 0) {
+            return false;
+        }
+
+        block_t *block = get_block_from_payload(ptr);
+        assert(!is_free(block));
+        if (adjusted_size > get_size(block)) {
+            block_t *next = get_next_phys(block);
+            if (!is_free(next) || get_size(block) + block_header_size + get_size(next) < adjusted_size) {
+                return false;
+            }
+            merge_with_next(block);
+        }
+
+        trim_used_block(block, adjusted_size);
+        return true;
+    }
+
+    /// Size of the payload of an allocated block, may be bigger than requested.
+    static size_t get_usable_size(const void *ptr)
+    {
+        return get_size(get_block_from_payload(const_cast<void *>(ptr)));
+    }
+
+    /// Bytes of a region taken by the control structure and the block headers of an empty pool.
+    static size_t get_pool_overhead()
+    {
+        return sizeof(control_t) + alignment + 2 * block_header_size;
+    }
+
+    /**
+     * Visits every physical block in address order.
+     * @param func Called as func(payload_ptr, payload_size, used).
+     */
+    template <typename Func>
+    void for_each_block(Func func) const
+    {
+        const block_t *block = get_first_block();
+        while (!is_sentinel(block)) {
+            func(get_payload(block), get_size(block), !is_free(block));
+            block = get_next_phys(block);
+        }
+    }
+
+    /**
+     * Checks invariants of the pool: physical links are consistent, no two free
+     * blocks are adjacent and every free block is in the list its size maps to.
+     */
+    bool check() const
+    {
+        size_t free_blocks_in_memory = 0;
+        const block_t *prev = nullptr;
+        const block_t *block = get_first_block();
+        while (!is_sentinel(block)) {
+            if (block->prev_phys != prev) {
+                return false;
+            }
+            if (prev && is_free(prev) && is_free(block)) {
+                return false;
+            }
+            if (is_free(block)) {
+                free_blocks_in_memory++;
+            }
+            prev = block;
+            block = get_next_phys(block);
+        }
+
+        size_t free_blocks_in_lists = 0;
+        for (size_t fl = 0; fl < fl_index_count; ++fl) {
+            for (size_t sl = 0; sl < sl_index_count; ++sl) {
+                bool list_empty = control->blocks[fl][sl] == nullptr;
+                bool sl_bit = control->sl_bitmap[fl] & (1u << sl);
+                if (list_empty == sl_bit) {
+                    return false;
+                }
+                for (const block_t *free_block = control->blocks[fl][sl]; free_block; free_block = free_block->next_free) {
+                    size_t block_fl = 0, block_sl = 0;
+                    mapping_insert(get_size(free_block), &block_fl, &block_sl);
+                    if (!is_free(free_block) || block_fl != fl || block_sl != sl) {
+                        return false;
+                    }
+                    free_blocks_in_lists++;
+                }
+            }
+            bool fl_bit = control->fl_bitmap & (1u << fl);
+            if (fl_bit != (control->sl_bitmap[fl] != 0)) {
+                return false;
+            }
+        }
+        return free_blocks_in_lists == free_blocks_in_memory;
+    }
+
+private:
+    /**
+     * Header of every physical block. Links to neighbouring free blocks are
+     * stored in the payload of the block, so they cost nothing for used blocks.
+     */
+    struct block_t {
+        block_t *prev_phys;
+        size_t size_and_flags;
+        block_t *next_free;
+        block_t *prev_free;
+    };
+
+    struct control_t {
+        uint32_t fl_bitmap;
+        uint32_t sl_bitmap[fl_index_count];
+        block_t *blocks[fl_index_count][sl_index_count];
+    };
+
+    static constexpr size_t block_header_size = offsetof(block_t, next_free);
+    static constexpr size_t min_block_size = sizeof(block_t) - block_header_size;
+    static constexpr size_t block_free_bit = 1;
+
+    control_t *control = nullptr;
+
+    static size_t get_size(const block_t *block)
+    {
+        return block->size_and_flags & ~block_free_bit;
+    }
+
+    static void set_size(block_t *block, size_t size)
+    {
+        block->size_and_flags = size | (block->size_and_flags & block_free_bit);
+    }
+
+    static bool is_free(const block_t *block)
+    {
+        return block->size_and_flags & block_free_bit;
+    }
+
+    static void mark_free(block_t *block)
+    {
+        block->size_and_flags |= block_free_bit;
+    }
+
+    static void mark_used(block_t *block)
+    {
+        block->size_and_flags &= ~block_free_bit;
+    }
+
+    static bool is_sentinel(const block_t *block)
+    {
+        return get_size(block) == 0;
+    }
+
+    static void * get_payload(const block_t *block)
+    {
+        return reinterpret_cast<void *>(reinterpret_cast<address_t>(block) + block_header_size);
+    }
+
+    static block_t * get_block_from_payload(void *ptr)
+    {
+        return reinterpret_cast<block_t *>(reinterpret_cast<address_t>(ptr) - block_header_size);
+    }
+
+    static block_t * get_next_phys(const block_t *block)
+    {
+        return reinterpret_cast<block_t *>(reinterpret_cast<address_t>(get_payload(block)) + get_size(block));
+    }
+
+    const block_t * get_first_block() const
+    {
+        return reinterpret_cast<const block_t *>(align_size_up(reinterpret_cast<address_t>(control) + sizeof(control_t)));
+    }
+
+    /// Index of the most significant set bit.
+    static size_t fls(size_t word)
+    {
+        return 8 * sizeof(unsigned long long) - 1 - __builtin_clzll(word);
+    }
+
+    /// Index of the least significant set bit.
+    static size_t ffs(uint32_t word)
+    {
+        return __builtin_ctz(word);
+    }
+
+    static size_t adjust_request_size(size_t size)
+    {
+        if (size > block_size_max) {
+            return 0;
+        }
+        size = align_size_up(size);
+        return size < min_block_size ? min_block_size : size;
+    }
+
+    static void mapping_insert(size_t size, size_t *fl, size_t *sl)
+    {
+        if (size < small_block_size) {
+            *fl = 0;
+            *sl = size / (small_block_size / sl_index_count);
+        }
+        else {
+            size_t msb = fls(size);
+            *sl = (size >> (msb - sl_index_count_log2)) ^ (size_t{1} << sl_index_count_log2);
+            *fl = msb - (fl_index_shift - 1);
+        }
+    }
+
+    /// Like mapping_insert, but rounds up so that any block in the list fits.
+    static void mapping_search(size_t size, size_t *fl, size_t *sl)
+    {
+        if (size >= small_block_size) {
+            size += (size_t{1} << (fls(size) - sl_index_count_log2)) - 1;
+        }
+        mapping_insert(size, fl, sl);
+    }
+
+    block_t * search_suitable_block(size_t *fl, size_t *sl) const
+    {
+        if (*fl >= fl_index_count) {
+            return nullptr;
+        }
+
+        uint32_t sl_map = control->sl_bitmap[*fl] & (~0u << *sl);
+        if (!sl_map) {
+            uint32_t fl_map = control->fl_bitmap & (~0u << (*fl + 1));
+            if (!fl_map) {
+                return nullptr;
+            }
+            *fl = ffs(fl_map);
+            sl_map = control->sl_bitmap[*fl];
+        }
+        *sl = ffs(sl_map);
+        return control->blocks[*fl][*sl];
+    }
+
+    block_t * locate_free_block(size_t size)
+    {
+        size_t fl = 0, sl = 0;
+        mapping_search(size, &fl, &sl);
+        block_t *block = search_suitable_block(&fl, &sl);
+        if (block) {
+            assert(get_size(block) >= size);
+            remove_free_block(block, fl, sl);
+        }
+        return block;
+    }
+
+    void insert_free_block(block_t *block)
+    {
+        size_t fl = 0, sl = 0;
+        mapping_insert(get_size(block), &fl, &sl);
+
+        block_t *current = control->blocks[fl][sl];
+        block->next_free = current;
+        block->prev_free = nullptr;
+        if (current) {
+            current->prev_free = block;
+        }
+        control->blocks[fl][sl] = block;
+        control->fl_bitmap |= 1u << fl;
+        control->sl_bitmap[fl] |= 1u << sl;
+    }
+
+    void remove_free_block(block_t *block, size_t fl, size_t sl)
+    {
+        block_t *prev = block->prev_free;
+        block_t *next = block->next_free;
+        if (next) {
+            next->prev_free = prev;
+        }
+        if (prev) {
+            prev->next_free = next;
+        }
+
+        if (control->blocks[fl][sl] == block) {
+            control->blocks[fl][sl] = next;
+            if (!next) {
+                control->sl_bitmap[fl] &= ~(1u << sl);
+                if (!control->sl_bitmap[fl]) {
+                    control->fl_bitmap &= ~(1u << fl);
+                }
+            }
+        }
+    }
+
+    void remove_free_block(block_t *block)
+    {
+        size_t fl = 0, sl = 0;
+        mapping_insert(get_size(block), &fl, &sl);
+        remove_free_block(block, fl, sl);
+    }
+
+    /**
+     * Splits free block after given size of payload.
+     * @return The second, free part of the block, not inserted into any list.
+     */
+    block_t * split_block(block_t *block, size_t size)
+    {
+        assert(get_size(block) >= size + block_header_size + min_block_size);
+
+        auto remaining = reinterpret_cast<block_t *>(reinterpret_cast<address_t>(get_payload(block)) + size);
+        remaining->size_and_flags = 0;
+        set_size(remaining, get_size(block) - size - block_header_size);
+        remaining->prev_phys = block;
+        mark_free(remaining);
+        get_next_phys(remaining)->prev_phys = remaining;
+
+        set_size(block, size);
+        return remaining;
+    }
+
+    /// Splits the rest of the free block off if it is big enough to form a block.
+    void trim_free_block(block_t *block, size_t size)
+    {
+        if (get_size(block) < size + block_header_size + min_block_size) {
+            return;
+        }
+        insert_free_block(split_block(block, size));
+    }
+
+    /// Gives the end of the used block back to the pool if it is big enough to form a block.
+    void trim_used_block(block_t *block, size_t size)
+    {
+        if (get_size(block) < size + block_header_size + min_block_size) {
+            return;
+        }
+        block_t *remaining = split_block(block, size);
+        remaining = merge_with_next(remaining);
+        insert_free_block(remaining);
+    }
+
+    /// Absorbs next block into given one.
+    static void absorb(block_t *block, block_t *next)
+    {
+        set_size(block, get_size(block) + block_header_size + get_size(next));
+        get_next_phys(block)->prev_phys = block;
+    }
+
+    block_t * merge_with_prev(block_t *block)
+    {
+        block_t *prev = block->prev_phys;
+        if (prev && is_free(prev)) {
+            remove_free_block(prev);
+            absorb(prev, block);
+            return prev;
+        }
+        return block;
+    }
+
+    block_t * merge_with_next(block_t *block)
+    {
+        block_t *next = get_next_phys(block);
+        if (is_free(next)) {
+            remove_free_block(next);
+            absorb(block, next);
+        }
+        return block;
+    }
+};
+
+#endif //TLSF_HPP
@@ -0,0 +1,142 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "allocator_exception.hpp"
+
+enum class trace_op : uint32_t {
+    allocate,
+    deallocate,
+    /// Block was resized in place, size is the new size.
+    resize
+};
+
+/// One operation of a trace. Blocks are identified by ids, addresses mean nothing to a replay.
+struct trace_record_t {
+    /// Nanoseconds since the recorder was created.
+    uint64_t timestamp;
+    uint64_t size;
+    uint32_t id;
+    trace_op op;
+};
+
+static_assert(sizeof(trace_record_t) == 24, "Trace records are written to the file as they are");
+
+/// Trace files start with this, followed by raw trace_record_t structures.
+constexpr char trace_magic[8] = {'I', 'B', 'T', 'R', 'A', 'C', 'E', '1'};
+
+/**
+ * Writes every allocation and deallocation made through inblock_allocator into
+ * a binary trace file, see inblock_allocator_heap::set_trace_recorder. Records
+ * are buffered and flushed when the buffer fills up and in the destructor.
+ * The recorder is thread-safe.
+ */
+class trace_recorder {
+public:
+    explicit trace_recorder(const std::string &path)
+        : file{path, std::ios::binary | std::ios::trunc},
+          start{std::chrono::steady_clock::now()}
+    {
+        if (!file) {
+            throw allocator_exception{"Cannot open trace file " + path};
+        }
+        file.write(trace_magic, sizeof(trace_magic));
+        buffer.reserve(buffer_capacity);
+    }
+
+    ~trace_recorder()
+    {
+        flush();
+    }
+
+    trace_recorder(const trace_recorder &) = delete;
+    trace_recorder & operator=(const trace_recorder &) = delete;
+
+    void record_allocate(const void *ptr, size_t size)
+    {
+        std::lock_guard<std::mutex> guard{mutex};
+        uint32_t id = next_id++;
+        live_ids[ptr] = id;
+        append(trace_op::allocate, id, size);
+    }
+
+    void record_deallocate(const void *ptr, size_t size)
+    {
+        std::lock_guard<std::mutex> guard{mutex};
+        auto it = live_ids.find(ptr);
+        if (it == live_ids.end()) {
+            return;
+        }
+        append(trace_op::deallocate, it->second, size);
+        live_ids.erase(it);
+    }
+
+    void record_resize(const void *ptr, size_t new_size)
+    {
+        std::lock_guard<std::mutex> guard{mutex};
+        auto it = live_ids.find(ptr);
+        if (it != live_ids.end()) {
+            append(trace_op::resize, it->second, new_size);
+        }
+    }
+
+    void flush()
+    {
+        std::lock_guard<std::mutex> guard{mutex};
+        write_buffer();
+        file.flush();
+    }
+
+private:
+    static constexpr size_t buffer_capacity = 4096;
+
+    std::ofstream file;
+    const std::chrono::steady_clock::time_point start;
+    std::mutex mutex;
+    std::vector<trace_record_t> buffer;
+    std::unordered_map<const void *, uint32_t> live_ids;
+    uint32_t next_id = 0;
+
+    void append(trace_op op, uint32_t id, size_t size)
+    {
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        uint64_t timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+        buffer.push_back(trace_record_t{timestamp, size, id, op});
+        if (buffer.size() == buffer_capacity) {
+            write_buffer();
+        }
+    }
+
+    void write_buffer()
+    {
+        file.write(reinterpret_cast<const char *>(buffer.data()),
+                   static_cast<std::streamsize>(buffer.size() * sizeof(trace_record_t)));
+        buffer.clear();
+    }
+};
+
+/// Loads whole trace written by trace_recorder.
+inline std::vector<trace_record_t> read_trace(const std::string &path)
+{
+    std::ifstream file{path, std::ios::binary};
+    char magic[sizeof(trace_magic)] = {};
+    if (!file.read(magic, sizeof(magic)) || std::memcmp(magic, trace_magic, sizeof(magic)) != 0) {
+        throw allocator_exception{"Not a trace file " + path};
+    }
+
+    std::vector<trace_record_t> records;
+    trace_record_t record;
+    while (file.read(reinterpret_cast<char *>(&record), sizeof(record))) {
+        records.push_back(record);
+    }
+    return records;
+}
+
+#endif //TRACE_HPP
@@ -4,6 +4,7 @@ include_directories(${Boost_INCLUDE_DIR})
 
 add_executable(unit_tests
         ${SOURCES}
+        ${MALLOC_SOURCES}
         tests/unit_tests.cpp
         )
 